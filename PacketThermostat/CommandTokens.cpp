@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include "CommandTokens.h"
+#include "ThermostatCommon.h"
+
+namespace {
+    /* Upper case, null separated, in CommandToken order.
+    ** Where one keyword starts with another, the longer must come first. */
+    const char CommandKeywords[] PROGMEM =
+        "HVAC FAN=O\0"
+        "HVACMAP=0X\0"
+        "RULE\0"
+        "HVAC_SETTINGS \0"
+        "HVAC_WEIGHTS \0"
+        "HVAC \0"
+        "HUM_SETTINGS\0"
+        "AUTO_SETTINGS\0"
+        "PREDICT_SETTINGS\0"
+        "HV \0"
+        "HS\0"
+        "TF=\0"
+        "T=\0"
+        "DU=\0"
+        "COMPRESSOR=0X\0"
+        "GROUP=\0"
+        "GRP \0"
+        "ER\0"
+        "EW\0"
+        "RH\0"
+        "STATS\0"
+        "SE\0"
+        "OS\0"
+        "LOG\0"
+        "RUNTIME\0"
+        "CRASH\0"
+        "UO=0X\0"
+        "I\0"
+        ;
+}
+
+CommandToken tokenizeCommand(const char *cmd, const char *&args)
+{
+    const char *k = CommandKeywords;
+    for (uint8_t t = 0; t < CMD_NONE; t++)
+    {
+        const char *p = cmd;
+        char c;
+        while ((c = pgm_read_byte(k)) != 0 && toupper(*p) == c)
+        {
+            k += 1;
+            p += 1;
+        }
+        if (c == 0)
+        {
+            args = p;
+            return static_cast<CommandToken>(t);
+        }
+        while (pgm_read_byte(k++) != 0) // skip the rest of the mismatched keyword
+            ;
+    }
+    args = cmd;
+    return CMD_NONE;
+}
+
+CommandView viewCommand(const char *text, uint8_t len, bool lookup)
+{
+    CommandView ret;
+    ret.text = text;
+    ret.len = len;
+    ret.args = text;
+    ret.token = lookup ? tokenizeCommand(text, ret.args) : CMD_SENSOR;
+    return ret;
+}
+
+uint16_t aDecimalToInt(const char*& p)
+{   // p is set to character following terminating non-digit, unless null
+    uint16_t ret = 0;
+    for (;;)
+    {
+        auto c = *p;
+        if (c >= '0' && c <= '9')
+        {
+            ret *= 10;
+            ret += c - '0';
+            p+=1;
+        } else 
+        {
+            if (c != 0)
+                p+=1;
+            return ret;
+        }
+    }
+}
+
+uint32_t aHexToInt(const char*&p)
+{   // p is set to character following terminating non-digit, unless null
+    uint32_t ret = 0;
+    for (;;)
+    {
+        auto c = *p;
+        if (isxdigit(c))
+        {
+            ret *= 16;
+            if (isdigit(c))
+                ret += c - '0';
+            else
+                ret += 10 + toupper(c) - 'A';
+            p+=1;
+        } else
+        {
+            if (c!= 0)
+                p+=1;
+            return ret;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+/* Commands arrive from the USB serial port and over the radio. The keyword at the
+** start of each command is looked up once, in a table in program memory, and
+** the ProcessCommand implementations switch on the resulting CommandToken
+** rather than each doing its own string compares.
+** Radio packets not addressed to us (sniffed thermometer reports) are not
+** looked up at all. They are CMD_SENSOR. */
+enum CommandToken : uint8_t {
+    // In the same order as CommandKeywords in CommandTokens.cpp
+    CMD_HVAC_FAN,       // HVAC FAN=O
+    CMD_HVACMAP,        // HVACMAP=0x
+    CMD_RULE,           // RULE
+    CMD_HVAC_SETTINGS,  // HVAC_SETTINGS
+    CMD_HVAC_WEIGHTS,   // HVAC_WEIGHTS
+    CMD_HVAC,           // HVAC 
+    CMD_HUM_SETTINGS,   // HUM_SETTINGS
+    CMD_AUTO_SETTINGS,  // AUTO_SETTINGS
+    CMD_PREDICT_SETTINGS, // PREDICT_SETTINGS
+    CMD_HV,             // HV 
+    CMD_HS,             // HS
+    CMD_TELEMETRY_FORMAT, // TF=
+    CMD_TIME,           // T=
+    CMD_DISPLAY_UNITS,  // DU=
+    CMD_COMPRESSOR,     // COMPRESSOR=0x
+    CMD_GROUP_ID,       // GROUP=
+    CMD_GROUP_COMMAND,  // GRP 
+    CMD_EEPROM_READ,    // ER
+    CMD_EEPROM_WRITE,   // EW
+    CMD_RH,             // RH
+    CMD_STATS,          // STATS
+    CMD_SCHEDULE,       // SE
+    CMD_OPTIMAL_START,  // OS
+    CMD_LOG,            // LOG
+    CMD_RUNTIME,        // RUNTIME
+    CMD_CRASH,          // CRASH
+    CMD_UPDATE_OUTPUTS, // UO=0x
+    CMD_INFO,           // I
+    CMD_NONE,           // not one of ours. Maybe the RadioConfiguration's
+    CMD_SENSOR,         // radio packet to some other node
+};
+
+/* Case insensitive match of the start of cmd against the keyword table.
+** args is set to the character following the keyword. */
+CommandToken tokenizeCommand(const char *cmd, const char *&args);
+
+/* A command as routed to the ProcessCommand implementations: its keyword is looked
+** up once, and every handler gets the same view of it rather than rescanning.
+** text is len characters, and a null follows them. args is where the arguments
+** start, just following the keyword. */
+struct CommandView {
+    const char *text;
+    const char *args;
+    uint8_t len;
+    CommandToken token;
+    uint8_t argsLen() const { return len - static_cast<uint8_t>(args - text); }
+};
+
+/* len characters at text, null terminated. With lookup false, the view is CMD_SENSOR
+** and its args are all of text. */
+CommandView viewCommand(const char *text, uint8_t len, bool lookup = true);
@@ -24,6 +24,7 @@ THE SOFTWARE.
 
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <stddef.h>
 #include "ThermostatCommon.h"
 
 
@@ -43,7 +44,13 @@ THE SOFTWARE.
 **          (d) HUM_SETTINGS              needed an addition for the COOL setting for the AUTO mode
 *           (e) AUTO_SETTINGS       for AUTO
 **    (4)   COMMIT command.         All the above set only the current memory and are lost on PCB power down. COMMIT 
-**    puts the settings to EEPROM to survive power down.
+**    puts the settings to EEPROM to survive power down. It waits until COMMIT_DEFER_MSEC pass with no
+**    further COMMIT, so a burst of setting changes costs one set of EEPROM writes. It writes the settings
+**    as of that COMMIT, kept in CommitSnapshot, and power lost while it waits loses them.
+**
+** EEPROM writes use update, which skips bytes that haven't changed. The target and activate temperatures
+** for HEAT, COOL and AUTO change most often, so they are saved in SetpointRing, which spreads their
+** writes across the top of the EEPROM.
 **
 ** The sketch .ino file allows for the above commands to be sent either by Serial or by the packet radio.
 */
@@ -55,20 +62,36 @@ class PassThrough; // The trivial type is PassThrough
 ** Each combination of inputs is mapped through EEPROM settings to an output */
 class MapInputToOutput;
 
+/* MapInputToOutputRules does the same with a short list of rules, each of which sets and
+** clears outputs when the inputs match. */
+class MapInputToOutputRules;
+
 /* OverrideAndDriveFromSensors ignores thermostat inputs and instead
 ** drives the furnace signals from what it sees in incoming radio packets.*/
 class OverrideAndDriveFromSensors;
 class HvacHeat; // subclass of OverrideAndDriveFromSensors
 class HvacCool; // subclass of OverrideAndDriveFromSensors
 class HvacAuto; // subclass of HvacCool -- switches between heat/cool
+class HvacPredictiveHeat; // subclass of HvacHeat -- stages on the measured rate of temperature rise
 
 namespace
 {   // support these types of mappings from available inputs to furnace outputs:
+    // The numbers are the TYPE= of Commands.md and don't depend on which classes are compiled in.
+    // A type whose class is compiled out keeps its count byte in EEPROM, but always has zero modes
     enum HvacTypes { HVAC_PASSTHROUGH, HVAC_MAPINPUTTOOUTPUT, HVAC_HEAT, HVAC_COOL, 
+        HVAC_AUTO, HVAC_PREDICTIVE_HEAT, HVAC_RULES, NUMBER_OF_HVAC_TYPES };
+
+    bool isDrivenFromSensors(int t)
+    {   // the types whose settings start with OverrideAndDriveFromSensors::Settings
+        return t == HVAC_HEAT || t == HVAC_COOL
 #if HVAC_AUTO_CLASS
-        HVAC_AUTO,
+            || t == HVAC_AUTO
 #endif
-        NUMBER_OF_HVAC_TYPES };
+#if HVAC_PREDICTIVE_CLASS
+            || t == HVAC_PREDICTIVE_HEAT
+#endif
+            ;
+    }
     const int NUM_INPUT_SIGNAL_COMBINATIONS = 1 << NUM_HVAC_INPUT_SIGNALS;
 
     const int HVAC_EEPROM_TYPE_AND_MODE_ADDR = HVAC_EEPROM_START; // .ino source tells this C++ module where to start
@@ -81,10 +104,27 @@ namespace
     
     extern HvacCommands* const ThermostatModeTypes[]; // forward declar
 
+    /* MODE= and COMMIT look up a mode's settings in EEPROM by the counts of the modes of each type
+    ** before it. ModeIndex keeps those counts, and where each type's settings start, in RAM.
+    ** ThermostatCommon::setup() and COUNT= rebuild it. */
+    namespace ModeIndex {
+        uint8_t count[NUMBER_OF_HVAC_TYPES];
+        uint16_t start[NUMBER_OF_HVAC_TYPES];
+        void rebuild();
+        uint32_t endWith(HvacTypes t, uint8_t modes); // where the settings would end if t had modes
+    }
+
     uint8_t NumberOfModesInType(HvacTypes t)
     {   // The EEPROM settings for the various HVAC modes allow for a variable number of each type.
+        return ModeIndex::count[t];
+    }
+
+    uint8_t ReadNumberOfModesInType(HvacTypes t)
+    {
         if (t == HVAC_PASSTHROUGH)
             return 1; // exactly one PassThrough as it only has a NAME and no other parameters
+        if (!ThermostatModeTypes[t])
+            return 0; // compiled out
         // one byte per type
         uint16_t addr = static_cast<int>(t) - 1;
         addr +=  HVAC_NUMBER_OF_MODES_IN_TYPE_ADDR;
@@ -100,13 +140,135 @@ namespace
             return; // cannot set PassThrough count
         uint16_t addr = static_cast<int>(t) - 1;
         addr +=  HVAC_NUMBER_OF_MODES_IN_TYPE_ADDR;
-        EEPROM.write(addr, count);
+        EEPROM.update(addr, count);
+        ModeIndex::rebuild();
     }
 
     uint16_t AddressOfModeTypeSettings(HvacTypes t, uint8_t which);
     const int NAME_LENGTH = 5; // without trailing null
+
+    const msec_time_stamp_t COMMIT_DEFER_MSEC = 10000;
+
+    /* The web front end sends HVAC_SETTINGS and HVAC COMMIT for every setpoint nudge.
+    ** Rather than rewrite the same bytes of the mode's settings each time, append the setpoint
+    ** to this ring of records at the top of EEPROM. The newest record for a TYPE/MODE, if any,
+    ** overrides the setpoint in that mode's settings. */
+    namespace SetpointRing {
+        struct Record_t {
+            uint8_t sequence; // one more than the previous record's
+            uint8_t typeAndMode; // 0xff is an empty record
+            int16_t targetCx10;
+            int16_t activateCx10;
+        };
+        const uint8_t NUMBER_OF_RECORDS = 16;
+        static_assert(NUMBER_OF_RECORDS < 256, "sequence numbers must not wrap around the ring");
+        const uint16_t START_ADDR = E2END + 1 - NUMBER_OF_RECORDS * sizeof(Record_t); // mode settings must stop here
+        const uint8_t EMPTY = 0xff;
+
+        uint16_t recordAddress(uint8_t i) {  return START_ADDR + i * sizeof(Record_t); }
+
+        uint8_t key(uint8_t type, uint8_t mode) { return mode < 32 ? (type << 5) | mode : EMPTY; }
+
+        uint8_t newest()
+        {   // the record not followed by its successor. or NUMBER_OF_RECORDS if the ring is empty
+            Record_t r, next;
+            EEPROM.get(recordAddress(0), next);
+            for (uint8_t i = 0; i < NUMBER_OF_RECORDS; i++)
+            {
+                r = next;
+                EEPROM.get(recordAddress(i + 1 < NUMBER_OF_RECORDS ? i + 1 : 0), next);
+                if (r.typeAndMode != EMPTY &&
+                    (next.typeAndMode == EMPTY || next.sequence != static_cast<uint8_t>(r.sequence + 1)))
+                    return i;
+            }
+            return NUMBER_OF_RECORDS;
+        }
+
+        uint8_t find(uint8_t k, uint8_t from, Record_t &r)
+        {   // search backwards from "from", not including it, for the newest record with key k
+            for (uint8_t n = 1; n < NUMBER_OF_RECORDS; n++)
+            {
+                uint8_t i = from >= n ? from - n : from + NUMBER_OF_RECORDS - n;
+                EEPROM.get(recordAddress(i), r);
+                if (r.typeAndMode == k)
+                    return i;
+            }
+            return NUMBER_OF_RECORDS;
+        }
+
+        bool load(uint8_t type, uint8_t mode, int16_t &targetCx10, int16_t &activateCx10)
+        {
+            uint8_t k = key(type, mode);
+            uint8_t head = newest();
+            if (k == EMPTY || head >= NUMBER_OF_RECORDS)
+                return false;
+            Record_t r;
+            EEPROM.get(recordAddress(head), r);
+            if (r.typeAndMode != k && find(k, head, r) >= NUMBER_OF_RECORDS)
+                return false;
+            targetCx10 = r.targetCx10;
+            activateCx10 = r.activateCx10;
+            return true;
+        }
+
+        void foldBack(const Record_t &r); // copy the record's setpoint into its mode's settings
+
+        // Returns false if this TYPE/MODE can't use the ring. Then the caller must save the setpoint itself
+        bool save(uint8_t type, uint8_t mode, int16_t targetCx10, int16_t activateCx10)
+        {
+            uint8_t k = key(type, mode);
+            if (k == EMPTY)
+                return false;
+            uint8_t head = newest();
+            uint8_t sequence = 0;
+            Record_t r;
+            if (head < NUMBER_OF_RECORDS)
+            {
+                EEPROM.get(recordAddress(head), r);
+                sequence = r.sequence + 1;
+                if ((r.typeAndMode == k || find(k, head, r) < NUMBER_OF_RECORDS) &&
+                    r.targetCx10 == targetCx10 && r.activateCx10 == activateCx10)
+                    return true; // unchanged
+            }
+            uint8_t next = head + 1 < NUMBER_OF_RECORDS ? head + 1 : 0;
+            EEPROM.get(recordAddress(next), r);
+            // the oldest record is about to be overwritten. If its the only one for its TYPE/MODE, fold it back
+            Record_t newer;
+            if (r.typeAndMode != EMPTY && r.typeAndMode != k && find(r.typeAndMode, next, newer) >= NUMBER_OF_RECORDS)
+                foldBack(r);
+            Record_t rec = { sequence, k, targetCx10, activateCx10 };
+            EEPROM.put(recordAddress(next), rec);
+            return true;
+        }
+
+        void clear(uint8_t belowType)
+        {   // fold back the newest record for each TYPE/MODE below belowType, and empty the ring
+            uint8_t head = newest();
+            if (head >= NUMBER_OF_RECORDS)
+                return;
+            for (uint8_t n = 0; n < NUMBER_OF_RECORDS; n++)
+            {
+                uint8_t i = head >= n ? head - n : head + NUMBER_OF_RECORDS - n;
+                Record_t r, newer;
+                EEPROM.get(recordAddress(i), r);
+                if (r.typeAndMode == EMPTY || (r.typeAndMode >> 5) >= belowType)
+                    continue;
+                bool isNewest = true;
+                for (uint8_t m = 0; isNewest && m < n; m++)
+                {
+                    EEPROM.get(recordAddress(head >= m ? head - m : head + NUMBER_OF_RECORDS - m), newer);
+                    isNewest = newer.typeAndMode != r.typeAndMode;
+                }
+                if (isNewest)
+                    foldBack(r);
+            }
+            for (uint16_t a = START_ADDR; a <= E2END; a++)
+                EEPROM.update(a, EMPTY);
+        }
+    }
 }
 
+const int SETPOINT_RING_START = SetpointRing::START_ADDR;
 const char HVAC_SETTINGS[] = "HVAC_SETTINGS ";
 #if HVAC_AUTO_CLASS
 const char AUTO_SETTINGS[] = "AUTO_SETTINGS"; // This is the AUTO heat setting only
@@ -131,11 +293,14 @@ public:
         ReadSettings();
     }
     virtual void TurnFurnaceOff() {  Furnace::UpdateOutputs(0); }
+    static void commitIfDue(msec_time_stamp_t now, bool force = false);
 protected:
     // implement some of the pure virtuals from interface class
-    bool ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe) override;
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override;
     const char* ModeNameString() override {  return settingsFromEeprom.ModeName; }
     bool GetTargetAndActual(int16_t& targetCx10, int16_t& actualCx10) override { return false; }
+    void SetTargetCx10(int16_t) override {}
+    uint32_t SensorMask() override { return 0; }
     void loop(msec_time_stamp_t) override {}
 
      // add pure virtuals for subclasses
@@ -143,6 +308,22 @@ protected:
     virtual void ReadSettings() = 0;
     virtual void InitializeState() {}; // subclasses need not do this one
 
+    virtual uint8_t *Snapshot(uint8_t *p, bool swap)
+    {   // copy, or with swap exchange, this class's settings with those at p. Subclasses chain to their base
+        return snapshotBytes(p, &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
+    static uint8_t *snapshotBytes(uint8_t *p, void *live, size_t n, bool swap)
+    {
+        uint8_t *l = static_cast<uint8_t *>(live);
+        for (size_t i = 0; i < n; i++, p++)
+        {
+            uint8_t b = l[i];
+            if (swap)
+                l[i] = *p;
+            *p = b;
+        }
+        return p;
+    }
     uint16_t WriteEprom(uint16_t addr)
     {
  #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -152,7 +333,7 @@ protected:
         EEPROM.put(addr, settingsFromEeprom);
         auto ret = addr + sizeof(settingsFromEeprom);
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
-        int remaining = EEPROM.length();
+        int remaining = SetpointRing::START_ADDR;
         remaining -= ret;
         if (remaining < 0)
             Serial.println(F("ERROR: WriteEprom beyond capacity"));
@@ -175,6 +356,8 @@ protected:
         return addr + sizeof(settingsFromEeprom);
     }
     static Settings settingsFromEeprom;
+    static bool commitPending;
+    static msec_time_stamp_t commitRequestedAt;
 };
 
 class PassThrough : public HvacCommands
@@ -213,18 +396,30 @@ protected:
         Furnace::UpdateOutputs(value);
     }
 
-    bool ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe) override
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
     {
-        if (HvacCommands::ProcessCommand(cmd, len, senderid, toMe))
+        if (HvacCommands::ProcessCommand(cmd, senderid))
             return true; // give base class a chance
-        if (!toMe) // radio packets are sniffed from thermometers reporting to the gateway
-            return false;
-        static const char MAP[] = "HVACMAP=0x"; // command to overwrite mapping
 
-        if (strncmp(cmd, MAP, sizeof(MAP) - 1) == 0)
-        {   // fill in the map. All numbers in hex
-            const char* q = cmd + sizeof(MAP) - 1;
+        if (cmd.token == CMD_HVACMAP)
+        {   // HVACMAP=0x command to overwrite mapping. fill in the map. All numbers in hex
+            const char* q = cmd.args;
             uint8_t addr = aHexToInt(q); // first number in command is the address
+            if (*q == ':')
+            {   // packed: two hex digits per entry with no separators. 32 entries fit in CMD_BUFLEN
+                auto nibble = [](char c) -> uint8_t { return isdigit(c) ? c - '0' : 10 + toupper(c) - 'A'; };
+                const char *p = ++q;
+                uint8_t count = 0;
+                for (; isxdigit(p[0]) && isxdigit(p[1]); p += 2)
+                    count += 1;
+                while (isspace(*p)) p += 1;
+                // nothing is written unless every pair is whole and fits the map
+                if (*p || count == 0 || count > NUM_INPUT_SIGNAL_COMBINATIONS - addr)
+                    return false;
+                for (; count != 0; count--, q += 2)
+                    settingsFromEeprom.inputToOutput[addr++] = (nibble(q[0]) << 4) | nibble(q[1]);
+                return true;
+            }
             for (;;)
             {
                 if (!*q)
@@ -253,6 +448,10 @@ protected:
         ReadEprom(AddressOfModeTypeSettings(HVAC_MAPINPUTTOOUTPUT, MyModeNumber));
     }
 
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(HvacCommands::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
     uint16_t WriteEprom(uint16_t addr)
     {
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -287,7 +486,99 @@ protected:
     static Settings settingsFromEeprom;
 };
 
-static const msec_time_stamp_t SENSOR_TIMEOUT_MSEC = 1000L * 60L * 15L; // 15 minutes
+static const msec_time_stamp_t SENSOR_TIMEOUT_MSEC = 1000L * 60L * 15L; // 15 minutes. Older readings are not fused
+#if HVAC_RULES_CLASS
+class MapInputToOutputRules : public HvacCommands
+{   /* The outputs start as the inputs. Then each rule whose mustMatchMask equals the inputs, 
+    ** less its dontCareMask bits, clears its toClear outputs and sets its toSet outputs, in order.
+    ** The masks have the R signal as bit zero, like HS. Erased EEPROM rules never match. */
+public:
+    struct Rule_t {
+        uint8_t dontCareMask;
+        uint8_t mustMatchMask;
+        uint8_t toSet;
+        uint8_t toClear;
+    };
+    static const uint8_t NUM_RULES = 6;
+    struct Settings {
+        Rule_t rules[NUM_RULES];
+    };
+protected:
+    void OnInputsChanged(uint8_t inputs, uint8_t previous) override
+    {
+        inputs &= INPUT_SIGNAL_MASK;
+        uint8_t outputs = inputs;
+        for (uint8_t i = 0; i < NUM_RULES; i++)
+        {
+            const Rule_t &r = settingsFromEeprom.rules[i];
+            if ((inputs & ~r.dontCareMask) == r.mustMatchMask)
+                outputs = (outputs & ~r.toClear) | r.toSet;
+        }
+        Furnace::UpdateOutputs(outputs);
+    }
+
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
+    {
+        if (HvacCommands::ProcessCommand(cmd, senderid))
+            return true; // give base class a chance
+        if (cmd.token == CMD_RULE)
+        {   // RULE <which> <dontCareMask> <mustMatchMask> <toSet> <toClear>. All numbers in hex
+            const char *q = cmd.args;
+            while (isspace(*q)) q += 1;
+            Rule_t r;
+            memset(&r, 0, sizeof(r));
+            r.dontCareMask = 0xff; // always matches, and does nothing
+            if (*q == '*')
+            {   // RULE * clears them all
+                for (uint8_t i = 0; i < NUM_RULES; i++)
+                    settingsFromEeprom.rules[i] = r;
+                return true;
+            }
+            uint8_t which = aHexToInt(q);
+            if (which >= NUM_RULES)
+                return false;
+            if (*q)
+            {
+                r.dontCareMask = aHexToInt(q);
+                r.mustMatchMask = aHexToInt(q);
+                r.toSet = aHexToInt(q);
+                r.toClear = aHexToInt(q);
+            }
+            settingsFromEeprom.rules[which] = r;
+            return true;
+        }
+        return false;
+    }
+
+    void CommitSettings() override    {
+        WriteEprom(AddressOfModeTypeSettings(HVAC_RULES, MyModeNumber));
+    }
+    void ReadSettings() override {
+        ReadEprom(AddressOfModeTypeSettings(HVAC_RULES, MyModeNumber));
+    }
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(HvacCommands::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
+    uint16_t WriteEprom(uint16_t addr)
+    {
+        addr = HvacCommands::WriteEprom(addr);
+        EEPROM.put(addr, settingsFromEeprom);
+        return addr + sizeof(settingsFromEeprom);
+    }
+    uint16_t ReadEprom(uint16_t addr)
+    {
+        addr = HvacCommands::ReadEprom(addr);
+        EEPROM.get(addr, settingsFromEeprom);
+        return addr + sizeof(settingsFromEeprom);
+    }
+
+    static Settings settingsFromEeprom;
+};
+#endif
+
+static const msec_time_stamp_t FUSED_DECISION_MSEC = 1000L * 30L; // HVAC decision cadence
+static const uint8_t MAX_FUSED_SENSORS = 8; // the lowest 8 bits set in SensorMask
 
 class OverrideAndDriveFromSensors : public HvacCommands
 {
@@ -303,11 +594,13 @@ public:
         uint8_t OutputStage3; // and Stage 3
         uint16_t SecondsToSecondStage; // let run with actual beyond Target for this long before going to OutputStage2
         uint16_t SecondsToThirdStage;
+        uint8_t SensorWeights[MAX_FUSED_SENSORS]; // in SensorMask bit order. zero ignores the sensor
     };
 
     static bool fanContinuous() { return fanIsOn; }
 
 protected:
+    enum FurnaceState {STATE_OFF, STATE_STAGE1, STATE_STAGE2, STATE_STAGE3};
     void OnInputsChanged(uint8_t inputs, uint8_t previous) override  { return;} // ignore inputs
     void TurnFurnaceOff() override { Furnace::UpdateOutputs(settingsFromEeprom.AlwaysOnMask); }
     struct OffOnExit {
@@ -318,24 +611,16 @@ protected:
         }
         uint8_t off;
     };
-    bool ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe) override
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
     {
-        if (HvacCommands::ProcessCommand(cmd, len, senderid, toMe))
+        if (HvacCommands::ProcessCommand(cmd, senderid))
             return true;
 
-        if (toMe)
+        if (cmd.token != CMD_SENSOR)
         {   // Fan on/off commands
-            static const char FAN_CMD[] = "HVAC FAN=O";
-            const char* p = cmd;
-            const char* q = FAN_CMD;
-            while (*q)
-                if (toupper(*p++) != *q)
-                    break;
-                else q++;
-                
-            if (!*q) // matched
+            if (cmd.token == CMD_HVAC_FAN)
             {
-                fanIsOn = toupper(*p) == 'N';
+                fanIsOn = toupper(*cmd.args) == 'N';
                 if (fanIsOn)
                     Furnace::SetOutputBits(settingsFromEeprom.MaskFanOnly);
                 else if (fancoilState == STATE_OFF)
@@ -343,8 +628,7 @@ protected:
                 return true;
             }
 
-            q = strstr(cmd, HVAC_SETTINGS);
-            if (q)
+            if (cmd.token == CMD_HVAC_SETTINGS)
             {   // fill in the thermostat parameters
                 // Command looks like this:
                 // HVAC_SETTINGS <target temperature C> <activate temperature C> <sensor id mask> <Stage 1 Output> <Stage 2 Output> <Stage 3 Output> <Fan Mask> <Seconds to Stage 2> <seconds to Stage 3>
@@ -364,7 +648,7 @@ protected:
                     offOnExit.off |= settingsFromEeprom.MaskFanOnly;
                 fancoilState = STATE_OFF;
 
-                q += sizeof(HVAC_SETTINGS) - 1;
+                const char *q = cmd.args;
                 settingsFromEeprom.TemperatureTargetDegreesCx10 = aDecimalToInt(q);
                 // default activate temperature if not given
                 settingsFromEeprom.TemperatureActivateDegreesCx10 = ActivateTemperatureFromTarget(settingsFromEeprom.TemperatureTargetDegreesCx10);
@@ -389,9 +673,18 @@ protected:
                 settingsFromEeprom.SecondsToThirdStage = aDecimalToInt(q);
                 return true;
             }
+            if (cmd.token == CMD_HVAC_WEIGHTS)
+            {   // HVAC_WEIGHTS <w0> <w1> ... one per bit in SensorMask, lowest first
+                const char *q = cmd.args;
+                for (uint8_t i = 0; i < MAX_FUSED_SENSORS && *q; i++)
+                    settingsFromEeprom.SensorWeights[i] = aDecimalToInt(q);
+                return true;
+            }
             return false;
         }
 
+        if (senderid >= 32)
+            return false;
         uint32_t mask = 1L << senderid;
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print(F("C command. mask=0x"));
@@ -401,58 +694,90 @@ protected:
 #endif
         if (settingsFromEeprom.SensorMask & mask)
         {   // if we're configured to use this sensor
-            const auto now = millis();
-            if (lastHeardSensorId > 0 &&
-                (senderid > lastHeardSensorId) &&
-                (static_cast<msec_time_stamp_t>(now - lastHeardFromSensor) < SENSOR_TIMEOUT_MSEC))
-                return true; // ignore lower priority sensor if higher one has checked in recently
-            lastHeardFromSensor = now;
-            lastHeardSensorId = senderid;
+            uint8_t which = 0; // its position among the SensorMask bits
+            for (uint32_t below = settingsFromEeprom.SensorMask & (mask - 1); below != 0; below &= below - 1)
+                which += 1;
+            if (which >= MAX_FUSED_SENSORS)
+                return true;
 
             // Example thermometers:
             //      C:49433, B:244, T:+20.37
             //      C:1769, B:198, T:+20.58 R:45.46
-            int16_t tCx10 = parseForColon('T', cmd, len);
+            auto fields = findSensorFields(cmd.args, cmd.argsLen());
+            int16_t tCx10 = parseTenths(fields.t);
             if (tCx10 == -1)
                 return false;
-            int16_t rhx10 = parseForColon('R', cmd, len);
-            auto prevState = fancoilState;
-            uint8_t output = settingsFromEeprom.AlwaysOnMask;
-            bool needToBeOn = OnReceivedTemperatureInput(tCx10);
-            previousActual = tCx10;
-            if (!needToBeOn)
+            auto &reading = sensorReadings[which];
+            reading.tCx10 = tCx10;
+            reading.rhX10 = parseTenths(fields.r);
+            reading.when = lastHeardFromSensor = millis();
+            sensorsHeard |= 1 << which;
+            sensorsUpdated = true;
+            return true;
+        }
+        return false;
+    }
+
+    /* Each sensor packet only updates sensorReadings. On the FUSED_DECISION_MSEC cadence, 
+    ** the weighted mean of the fresh readings drives the outputs. */
+    void fuseSensors(msec_time_stamp_t now)
+    {
+        if (!sensorsUpdated || static_cast<msec_time_stamp_t>(now - lastFusedDecision) < FUSED_DECISION_MSEC)
+            return;
+        lastFusedDecision = now;
+        sensorsUpdated = false;
+        int32_t tSum = 0; uint16_t tWeights = 0;
+        int32_t rhSum = 0; uint16_t rhWeights = 0;
+        for (uint8_t i = 0; i < MAX_FUSED_SENSORS; i++)
+        {
+            const auto &reading = sensorReadings[i];
+            const uint8_t w = settingsFromEeprom.SensorWeights[i];
+            if (w == 0 || (sensorsHeard & (1 << i)) == 0 ||
+                static_cast<msec_time_stamp_t>(now - reading.when) >= SENSOR_TIMEOUT_MSEC)
+                continue;
+            tSum += static_cast<int32_t>(w) * reading.tCx10;
+            tWeights += w;
+            if (reading.rhX10 > 0)
             {
-                fancoilState = STATE_OFF;
-                // give subclass a second chance to set the output (HvacAuto)
-                output = OnReceivedTemperatureInput2(tCx10, output);
+                rhSum += static_cast<int32_t>(w) * reading.rhX10;
+                rhWeights += w;
             }
-            else
+        }
+        if (tWeights == 0)
+            return; // nothing fresh. isSensorTimedOut eventually turns us off
+        int16_t tCx10 = tSum / tWeights;
+        int16_t rhx10 = rhWeights != 0 ? rhSum / rhWeights : -1;
+#if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
+        Serial.print(F("Fused t="));
+        Serial.print(tCx10);
+        Serial.print(F(" rh="));
+        Serial.println(rhx10);
+#endif
+        uint8_t output = settingsFromEeprom.AlwaysOnMask;
+        bool needToBeOn = OnReceivedTemperatureInput(tCx10);
+        previousActual = tCx10;
+        if (!needToBeOn)
+        {
+            fancoilState = STATE_OFF;
+            // give subclass a second chance to set the output (HvacAuto)
+            output = OnReceivedTemperatureInput2(tCx10, output);
+        }
+        else
+        {
+            if (fancoilState == STATE_OFF)
             {
-                if (fancoilState == STATE_OFF)
-                {
-                    fancoilState = STATE_STAGE1;
-                    output = settingsFromEeprom.OutputStage1;
-                    timeEnteredStage1 = millis();
-                }
-                else
-                {
-                    int32_t sinceStage1 = millis() - timeEnteredStage1;
-                    if (sinceStage1 >= settingsFromEeprom.SecondsToThirdStage * 1000l)
-                        output = settingsFromEeprom.OutputStage3;
-                    else if (sinceStage1 >= settingsFromEeprom.SecondsToSecondStage * 1000l)
-                        output = settingsFromEeprom.OutputStage2;
-                    else
-                        output = settingsFromEeprom.OutputStage1;
-                }
+                fancoilState = STATE_STAGE1;
+                timeEnteredStage1 = millis();
             }
-            if (rhx10 > 0)
-                output = OnReceivedHumidityInput(rhx10, tCx10, output);
-            if (fanIsOn)
-                output |= settingsFromEeprom.MaskFanOnly;
-            Furnace::UpdateOutputs(output);
-            return true;
+            else
+                fancoilState = StageWhileOn(millis(), tCx10);
+            output = OutputForStage(fancoilState);
         }
-        return false;
+        if (rhx10 > 0)
+            output = OnReceivedHumidityInput(rhx10, tCx10, output);
+        if (fanIsOn)
+            output |= settingsFromEeprom.MaskFanOnly;
+        Furnace::UpdateOutputs(output);
     }
     
     bool isSensorTimedOut(msec_time_stamp_t now)
@@ -472,6 +797,7 @@ protected:
 
     void loop(msec_time_stamp_t now) override
     { 
+        fuseSensors(now);
         // is it time to move to a later stage?
         if (fancoilState != STATE_OFF)
         {
@@ -480,71 +806,80 @@ protected:
                 fancoilState = STATE_OFF;
                 return;
             }
-            int32_t sinceStage1 = now - timeEnteredStage1;
-            if (sinceStage1 >= settingsFromEeprom.SecondsToThirdStage * 1000l)
+            auto stage = StageWhileOn(now, NO_NEW_READING);
+            if (stage != fancoilState)
             {
-                if (fancoilState != STATE_STAGE3)
-                {
-                    fancoilState = STATE_STAGE3;
-                    Furnace::UpdateOutputs(settingsFromEeprom.OutputStage3);
-                }
-            }
-            else if (sinceStage1 >= settingsFromEeprom.SecondsToSecondStage * 1000l)
-            {
-                if (fancoilState != STATE_STAGE2)
-                {
-                    fancoilState = STATE_STAGE2;
-                    Furnace::UpdateOutputs(settingsFromEeprom.OutputStage2);
-                }
+                fancoilState = stage;
+                Furnace::UpdateOutputs(OutputForStage(stage));
             }
         }
     }
 
-    static int16_t parseForColon(char flag, const char* p, uint8_t len)
-    {   // help parse the Wireless Thermometer packet
-        int16_t ret(0);
-        uint8_t c = len;
-        for (;;)
+    static const int16_t NO_NEW_READING = -32767 - 1;
+    /* Which stage to run while the HVAC needs to be on. Called from loop() with NO_NEW_READING,
+    ** and with each fused temperature. Here, the stage moves up after SecondsToSecondStage 
+    ** and SecondsToThirdStage regardless of the temperature. */
+    virtual FurnaceState StageWhileOn(msec_time_stamp_t now, int16_t tCx10)
+    {
+        int32_t sinceStage1 = now - timeEnteredStage1;
+        if (sinceStage1 >= settingsFromEeprom.SecondsToThirdStage * 1000l)
+            return STATE_STAGE3;
+        if (sinceStage1 >= settingsFromEeprom.SecondsToSecondStage * 1000l)
+            return STATE_STAGE2;
+        return STATE_STAGE1;
+    }
+
+    static uint8_t OutputForStage(FurnaceState stage)
+    {
+        if (stage == STATE_STAGE3)
+            return settingsFromEeprom.OutputStage3;
+        if (stage == STATE_STAGE2)
+            return settingsFromEeprom.OutputStage2;
+        return settingsFromEeprom.OutputStage1;
+    }
+
+    struct SensorFields {
+        const char *t; // following the "T:", or null if none
+        const char *r; // following the "R:"
+    };
+
+    static SensorFields findSensorFields(const char *p, uint8_t len)
+    {   // help parse the Wireless Thermometer packet. One pass finds both fields
+        SensorFields ret = { 0, 0 };
+        for (uint8_t i = 0; i + 1 < len && p[i]; i++)
         {
-            if (!*p)
-                return -1;
-            if (c == 0)
-                return -1;
-            if (p[0] == flag && p[1] == ':')
-            {
-                p += 2;  c -= 2;
-                bool neg = false;
-                if (*p == '-')
-                {
-                    neg = true;
-                    p += 1;
-                    c -= 1;
-                } else if (*p == '+')
-                {
-                    neg = false;
-                    p += 1;
-                    c -= 1;
-                }
-                ret = aDecimalToInt(p) * 10;
-                if (isdigit(*p))
-                    ret += *p - '0';
-                if (neg)
-                    ret = -ret;
-                break;
-            } else
-            {
-                p += 1;
-                c -= 1;
-            }
+            if (p[i + 1] != ':')
+                continue;
+            if (p[i] == 'T' && !ret.t)
+                ret.t = p + i + 2;
+            else if (p[i] == 'R' && !ret.r)
+                ret.r = p + i + 2;
         }
         return ret;
     }
 
+    static int16_t parseTenths(const char *p)
+    {   // +20.37 is 203. No field is -1
+        if (!p)
+            return -1;
+        bool neg = *p == '-';
+        if (neg || *p == '+')
+            p += 1;
+        int16_t ret = aDecimalToInt(p) * 10;
+        if (isdigit(*p))
+            ret += *p - '0';
+        return neg ? -ret : ret;
+    }
+
     virtual bool OnReceivedTemperatureInput(int16_t degCx10) = 0; // false return means turn off the HVAC
     virtual int16_t ActivateTemperatureFromTarget(int16_t  target) = 0; // 
     virtual uint8_t OnReceivedTemperatureInput2(int16_t degCx10, uint8_t output) { return output;}
     virtual uint8_t OnReceivedHumidityInput(int16_t rhX10, int16_t degCx10, uint8_t mask) { return mask;}
 
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(HvacCommands::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
     uint16_t WriteEprom(uint16_t addr)
     {
         addr = HvacCommands::WriteEprom(addr);
@@ -554,13 +889,25 @@ protected:
         Serial.print(F(" t="));
         Serial.println(settingsFromEeprom.TemperatureTargetDegreesCx10);
 #endif
-        EEPROM.put(addr, settingsFromEeprom);
+        Settings toWrite = settingsFromEeprom;
+        if (SetpointRing::save(MyTypeNumber, MyModeNumber,
+                settingsFromEeprom.TemperatureTargetDegreesCx10, settingsFromEeprom.TemperatureActivateDegreesCx10))
+        {   // the ring holds the setpoint. leave the copy here alone so update skips it
+            Settings old;
+            EEPROM.get(addr, old);
+            toWrite.TemperatureTargetDegreesCx10 = old.TemperatureTargetDegreesCx10;
+            toWrite.TemperatureActivateDegreesCx10 = old.TemperatureActivateDegreesCx10;
+        }
+        EEPROM.put(addr, toWrite);
         return addr + sizeof(settingsFromEeprom);
     }
     uint16_t ReadEprom(uint16_t addr)
     {
         addr = HvacCommands::ReadEprom(addr);
         EEPROM.get(addr, settingsFromEeprom);
+        defaultWeightsIfInvalid();
+        SetpointRing::load(MyTypeNumber, MyModeNumber,
+                settingsFromEeprom.TemperatureTargetDegreesCx10, settingsFromEeprom.TemperatureActivateDegreesCx10);
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print(F("OverrideAndDriveFromSensors::ReadEprom a="));
         Serial.print(addr, HEX);
@@ -574,11 +921,26 @@ protected:
         return addr + sizeof(settingsFromEeprom);
     }
 
+    void defaultWeightsIfInvalid()
+    {   /* Erased EEPROM (a new mode from COUNT=, or a layout change) reads 0xff weights, and
+        ** all zero weights ignore every sensor. Either way, weigh every sensor equally. */
+        bool allZero = true; bool erased = false;
+        for (uint8_t i = 0; i < MAX_FUSED_SENSORS; i++)
+        {
+            allZero &= settingsFromEeprom.SensorWeights[i] == 0;
+            erased |= settingsFromEeprom.SensorWeights[i] == 0xff;
+        }
+        if (allZero || erased)
+            memset(settingsFromEeprom.SensorWeights, 1, sizeof(settingsFromEeprom.SensorWeights));
+    }
+
     void InitializeState() override 
     {
         timeEnteredStage1 = 
         lastHeardFromSensor = millis();
-        lastHeardSensorId = 0;
+        lastFusedDecision = lastHeardFromSensor - FUSED_DECISION_MSEC; // first reading is used right away
+        sensorsHeard = 0;
+        sensorsUpdated = false;
         fancoilState = STATE_OFF;
         fanIsOn = false;
         previousActual = 0;
@@ -591,10 +953,26 @@ protected:
         return true; 
     }
 
+    void SetTargetCx10(int16_t targetCx10) override
+    {
+        settingsFromEeprom.TemperatureTargetDegreesCx10 = targetCx10;
+        settingsFromEeprom.TemperatureActivateDegreesCx10 = ActivateTemperatureFromTarget(targetCx10);
+    }
+
+    uint32_t SensorMask() override { return settingsFromEeprom.SensorMask; }
+
     static msec_time_stamp_t lastHeardFromSensor; 
-    static uint8_t lastHeardSensorId;
+    struct SensorReading {
+        int16_t tCx10;
+        int16_t rhX10; // -1 if the sensor doesn't report humidity
+        msec_time_stamp_t when;
+    };
+    static SensorReading sensorReadings[MAX_FUSED_SENSORS];
+    static uint8_t sensorsHeard; // bit mask of sensorReadings that are valid
+    static bool sensorsUpdated;
+    static msec_time_stamp_t lastFusedDecision;
     static msec_time_stamp_t timeEnteredStage1; 
-    static enum FurnaceState {STATE_OFF, STATE_STAGE1, STATE_STAGE2, STATE_STAGE3} fancoilState;
+    static FurnaceState fancoilState;
     static bool fanIsOn;
     static Settings settingsFromEeprom;
     static uint16_t previousActual;
@@ -623,6 +1001,124 @@ protected:
     }
 };
 
+#if HVAC_PREDICTIVE_CLASS
+class HvacPredictiveHeat : public HvacHeat
+{   /* HEAT that moves between stages on how long the room will take to reach its target at the
+    ** rate it has been warming, rather than on time alone. The rate is measured from the first fused
+    ** reading after a stage change has settled. The stage moves up when the projected time exceeds
+    ** the setting for the next stage, and back down when it is under half the setting for this stage. 
+    ** A stage runs at least SecondsToSettle before the next move, so each move is a real trend. */
+public:
+    struct Settings {
+        uint16_t SecondsToTargetForStage2; // Stage 1 projected to take longer than this moves to Stage 2
+        uint16_t SecondsToTargetForStage3; // ...and Stage 2 to Stage 3
+        uint16_t SecondsToSettle;
+    };
+protected:
+    FurnaceState StageWhileOn(msec_time_stamp_t now, int16_t tCx10) override
+    {
+        if (static_cast<int32_t>(timeEnteredStage1 - stageChangedAt) > 0)
+        {   // a new call for heat
+            stageChangedAt = timeEnteredStage1;
+            haveSlopeStart = false;
+        }
+        if (tCx10 == NO_NEW_READING || 
+            now - stageChangedAt < settingsFromEeprom.SecondsToSettle * 1000ul)
+            return fancoilState;
+        if (!haveSlopeStart)
+        {
+            haveSlopeStart = true;
+            slopeStartCx10 = tCx10;
+            slopeStartTime = now;
+            return fancoilState;
+        }
+        uint32_t seconds = (now - slopeStartTime) / 1000;
+        if (seconds < settingsFromEeprom.SecondsToSettle)
+            return fancoilState;
+        int32_t rise = tCx10 - slopeStartCx10;
+        int32_t toGo = OverrideAndDriveFromSensors::settingsFromEeprom.TemperatureTargetDegreesCx10 - tCx10;
+        uint32_t projected = toGo <= 0 ? 0 :
+            rise > 0 ? toGo * seconds / rise : 0xffffffffu; // not warming is forever
+#if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
+        Serial.print(F("HvacPredictiveHeat projected seconds="));
+        Serial.println(projected);
+#endif
+        auto stage = fancoilState;
+        if (stage == STATE_STAGE1 && projected > settingsFromEeprom.SecondsToTargetForStage2)
+            stage = STATE_STAGE2;
+        else if (stage == STATE_STAGE2 && projected > settingsFromEeprom.SecondsToTargetForStage3)
+            stage = STATE_STAGE3;
+        else if (stage == STATE_STAGE3 && projected < settingsFromEeprom.SecondsToTargetForStage3 / 2)
+            stage = STATE_STAGE2;
+        else if (stage == STATE_STAGE2 && projected < settingsFromEeprom.SecondsToTargetForStage2 / 2)
+            stage = STATE_STAGE1;
+        if (stage != fancoilState)
+        {
+            stageChangedAt = now;
+            haveSlopeStart = false;
+        }
+        return stage;
+    }
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
+    {
+        if (HvacHeat::ProcessCommand(cmd, senderid))
+            return true;
+        if (cmd.token == CMD_PREDICT_SETTINGS)
+        {   // PREDICT_SETTINGS <seconds to target for Stage 2> <seconds to target for Stage 3> <seconds to settle>
+            // Like HVAC_SETTINGS, fields left off keep their values
+            const char *q = cmd.args;
+            if (!*(q++)) return true;
+            uint16_t v[3];
+            uint8_t n = 0;
+            while (n < 3)
+            {
+                v[n++] = aDecimalToInt(q);
+                if (!*q) break;
+            }
+            if (n == 3 && v[2] == 0)
+                return false; // without settling, Stage 3 would follow any positive projection at once
+            settingsFromEeprom.SecondsToTargetForStage2 = v[0];
+            if (n > 1)
+                settingsFromEeprom.SecondsToTargetForStage3 = v[1];
+            if (n > 2)
+                settingsFromEeprom.SecondsToSettle = v[2];
+            return true;
+        }
+        return false;
+    }
+    void CommitSettings() override    {
+        WriteEprom(AddressOfModeTypeSettings(HVAC_PREDICTIVE_HEAT, MyModeNumber));
+    }
+    void ReadSettings() override {
+        ReadEprom(AddressOfModeTypeSettings(HVAC_PREDICTIVE_HEAT, MyModeNumber));
+    }
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(OverrideAndDriveFromSensors::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
+    uint16_t WriteEprom(uint16_t addr)    {
+        addr = OverrideAndDriveFromSensors::WriteEprom(addr);
+        EEPROM.put(addr, settingsFromEeprom);
+        return addr + sizeof(settingsFromEeprom);
+    }
+    uint16_t ReadEprom(uint16_t addr)    {
+        addr = OverrideAndDriveFromSensors::ReadEprom(addr);
+        EEPROM.get(addr, settingsFromEeprom);
+        return addr + sizeof(settingsFromEeprom);
+    }
+    void InitializeState() override {
+        HvacHeat::InitializeState();
+        stageChangedAt = timeEnteredStage1;
+        haveSlopeStart = false;
+    }
+    static Settings settingsFromEeprom;
+    static msec_time_stamp_t stageChangedAt;
+    static msec_time_stamp_t slopeStartTime;
+    static int16_t slopeStartCx10;
+    static bool haveSlopeStart;
+};
+#endif
+
 class HvacCool : public OverrideAndDriveFromSensors
 {
 public:
@@ -670,26 +1166,21 @@ protected:
         return mask;
     }
 
-    bool ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe) override
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
     {
-        if (OverrideAndDriveFromSensors::ProcessCommand(cmd, len, senderid, toMe))
+        if (OverrideAndDriveFromSensors::ProcessCommand(cmd, senderid))
             return true;
-        if (toMe)
+        if (cmd.token == CMD_HUM_SETTINGS)
         {
-            static const char HUMIDIFY_SETTINGS[] = "HUM_SETTINGS";
-            const char *q = strstr(cmd, HUMIDIFY_SETTINGS);
-            if (q)
-            {
-                settingsFromEeprom.HumiditySettingX10 = 0xffffu; // turn it off
-                q += sizeof(HUMIDIFY_SETTINGS) - 1;
-                if (!*(q++)) return true;
-                settingsFromEeprom.HumiditySettingX10 = aDecimalToInt(q); 
-                if (!*q) return true;
-                settingsFromEeprom.MaskDehumidifyBitsOn = aHexToInt(q);
-                if (!*q) return true;
-                settingsFromEeprom.MaskDehumidifyBitsOff = aHexToInt(q);
-                return true;
-            }
+            settingsFromEeprom.HumiditySettingX10 = 0xffffu; // turn it off
+            const char *q = cmd.args;
+            if (!*(q++)) return true;
+            settingsFromEeprom.HumiditySettingX10 = aDecimalToInt(q); 
+            if (!*q) return true;
+            settingsFromEeprom.MaskDehumidifyBitsOn = aHexToInt(q);
+            if (!*q) return true;
+            settingsFromEeprom.MaskDehumidifyBitsOff = aHexToInt(q);
+            return true;
         }
         return false;
     }
@@ -699,6 +1190,10 @@ protected:
     void ReadSettings() override {
         ReadEprom(AddressOfModeTypeSettings(HVAC_COOL, MyModeNumber));
     }
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(OverrideAndDriveFromSensors::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
     uint16_t WriteEprom(uint16_t addr)    {
         addr = OverrideAndDriveFromSensors::WriteEprom(addr);
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -777,6 +1272,7 @@ protected:
     }
     void loop(msec_time_stamp_t now) override
     {
+        fuseSensors(now);
         if (heatState != HEAT_OFF)
         {
             if (isSensorTimedOut(now))
@@ -811,14 +1307,13 @@ protected:
         actualCx10 = previousActual;
         return true;
     }
-    bool ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe) override
+    bool ProcessCommand(const CommandView &cmd, uint8_t senderid) override
     {
-        if (HvacCool::ProcessCommand(cmd, len, senderid, toMe))
+        if (HvacCool::ProcessCommand(cmd, senderid))
             return true;
-        const char* q = strstr(cmd, AUTO_SETTINGS);
-        if (q)
+        if (cmd.token == CMD_AUTO_SETTINGS)
         {
-            q += sizeof(AUTO_SETTINGS) - 1;
+            const char* q = cmd.args;
             if (!*(q++)) return true;
             settingsFromEeprom.TemperatureTargetHeatDegreesCx10 = aDecimalToInt(q);
             settingsFromEeprom.TemperatureActivateHeatDegreesCx10 = 
@@ -843,6 +1338,10 @@ protected:
     void ReadSettings() override {
         ReadEprom(AddressOfModeTypeSettings(HVAC_AUTO, MyModeNumber));
     }
+    uint8_t *Snapshot(uint8_t *p, bool swap) override
+    {
+        return snapshotBytes(HvacCool::Snapshot(p, swap), &settingsFromEeprom, sizeof(settingsFromEeprom), swap);
+    }
     uint16_t WriteEprom(uint16_t addr)
     {
         addr = HvacCool::WriteEprom(addr);
@@ -886,23 +1385,38 @@ namespace
 #if HVAC_AUTO_CLASS
     HvacAuto hvacAuto;
 #endif
+#if HVAC_PREDICTIVE_CLASS
+    HvacPredictiveHeat hvacPredictiveHeat;
+#endif
+#if HVAC_RULES_CLASS
+    MapInputToOutputRules mapInputToOutputRules;
+#endif
 
     HvacCommands* const ThermostatModeTypes[NUMBER_OF_HVAC_TYPES] =
-    {   // Order must match enum HvacTypes
+    {   // Order must match enum HvacTypes. Null for a type compiled out
         &passThrough,
         &mapInputToOutput,
         &hvacHeat,
         &hvacCool,
 #if HVAC_AUTO_CLASS
-        &hvacAuto
+        &hvacAuto,
+#else
+        0,
+#endif
+#if HVAC_PREDICTIVE_CLASS
+        &hvacPredictiveHeat,
+#else
+        0,
+#endif
+#if HVAC_RULES_CLASS
+        &mapInputToOutputRules,
+#else
+        0,
 #endif
     };
 
-    uint16_t AddressOfModeTypeSettings(HvacTypes t, uint8_t which)
-    {
-        if (which > NumberOfModesInType(t)) // allow asking for address of one past the last
-            return -1;
-        // calculate the size of the Settings, taking into account inheritance.
+    size_t SizeOfModeTypeSettings(HvacTypes t)
+    {   // calculate the size of the Settings, taking into account inheritance.
         size_t sze = sizeof(HvacCommands::Settings); // all inherit from HvacCommands
         switch (t)
         {
@@ -910,6 +1424,18 @@ namespace
             sze += sizeof(MapInputToOutput::Settings);
             break; // remainder do not inherit from MapInputToOutput
 
+#if HVAC_RULES_CLASS
+        case HVAC_RULES:
+            sze += sizeof(MapInputToOutputRules::Settings);
+            break;
+#endif
+
+#if HVAC_PREDICTIVE_CLASS
+        case HVAC_PREDICTIVE_HEAT:
+            sze += sizeof(HvacPredictiveHeat::Settings) + sizeof(OverrideAndDriveFromSensors::Settings);
+            break;
+#endif
+
 #if HVAC_AUTO_CLASS
         case HVAC_AUTO:
             sze += sizeof(HvacAuto::Settings); // inherits from those below
@@ -924,31 +1450,38 @@ namespace
         default:
             break;
         }
+        return sze;
+    }
 
-        uint16_t ret = -1;
+    void ModeIndex::rebuild()
+    {   // each type's settings follow those of the type numbered before it
+        uint16_t addr = HVAC_MODES_EEPROM_START_ADDR;
+        for (uint8_t t = 0; t < NUMBER_OF_HVAC_TYPES; t++)
+        {
+            auto tp = static_cast<HvacTypes>(t);
+            count[t] = ReadNumberOfModesInType(tp);
+            start[t] = addr;
+            addr += count[t] * SizeOfModeTypeSettings(tp);
+        }
+    }
 
-        switch (t)
+    uint32_t ModeIndex::endWith(HvacTypes t, uint8_t modes)
+    {
+        uint32_t addr = HVAC_MODES_EEPROM_START_ADDR;
+        for (uint8_t i = 0; i < NUMBER_OF_HVAC_TYPES; i++)
         {
-        case HVAC_PASSTHROUGH:
-            ret = HVAC_MODES_EEPROM_START_ADDR + which * sze;
-            break;
-        case HVAC_MAPINPUTTOOUTPUT:
-            ret = AddressOfModeTypeSettings(HVAC_PASSTHROUGH, NumberOfModesInType(HVAC_PASSTHROUGH)) + which * sze;
-            break;
-        case HVAC_HEAT:
-            ret = AddressOfModeTypeSettings(HVAC_MAPINPUTTOOUTPUT, NumberOfModesInType(HVAC_MAPINPUTTOOUTPUT)) + which * sze;
-            break;
-        case HVAC_COOL:
-            ret = AddressOfModeTypeSettings(HVAC_HEAT, NumberOfModesInType(HVAC_HEAT)) + which * sze;
-            break;
-#if HVAC_AUTO_CLASS
-        case HVAC_AUTO:
-            ret = AddressOfModeTypeSettings(HVAC_COOL, NumberOfModesInType(HVAC_COOL)) + which * sze;
-            break;
-#endif
-        default:
-            return -1;
+            auto tp = static_cast<HvacTypes>(i);
+            addr += static_cast<uint32_t>(tp == t ? modes : count[i]) * SizeOfModeTypeSettings(tp);
         }
+        return addr;
+    }
+
+    uint16_t AddressOfModeTypeSettings(HvacTypes t, uint8_t which)
+    {
+        if (t >= NUMBER_OF_HVAC_TYPES || which > NumberOfModesInType(t)) // allow asking for address of one past the last
+            return -1;
+        size_t sze = SizeOfModeTypeSettings(t);
+        uint16_t ret = ModeIndex::start[t] + which * sze;
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print("AddressOfModeTypeSettings type=");
         Serial.print(static_cast<int>(t));
@@ -963,12 +1496,66 @@ namespace
 #endif
         return ret;
     }
+
+    void SetpointRing::foldBack(const Record_t &r)
+    {
+        auto t = static_cast<HvacTypes>(r.typeAndMode >> 5);
+        uint8_t mode = r.typeAndMode & 0x1f;
+        if (!isDrivenFromSensors(t) || mode >= NumberOfModesInType(t))
+            return;
+        uint16_t addr = AddressOfModeTypeSettings(t, mode) + sizeof(HvacCommands::Settings);
+        EEPROM.put(addr + offsetof(OverrideAndDriveFromSensors::Settings, TemperatureTargetDegreesCx10), r.targetCx10);
+        EEPROM.put(addr + offsetof(OverrideAndDriveFromSensors::Settings, TemperatureActivateDegreesCx10), r.activateCx10);
+    }
 }
 
 ThermostatCommon* hvac = &passThrough;
 
+namespace CommitSnapshot {
+    /* The current mode's settings as they were at the last COMMIT, in the order Snapshot chains them.
+    ** A deferred COMMIT writes these, not whatever HVAC_SETTINGS changed since. */
+    union Largest { // the settings below HvacCommands of each type
+        MapInputToOutput::Settings map;
+#if HVAC_RULES_CLASS
+        MapInputToOutputRules::Settings rules;
+#endif
+        struct {
+            OverrideAndDriveFromSensors::Settings driven;
+            HvacCool::Settings cool;
+#if HVAC_AUTO_CLASS
+            HvacAuto::Settings autoMode;
+#endif
+        } coolAndAuto;
+#if HVAC_PREDICTIVE_CLASS
+        struct {
+            OverrideAndDriveFromSensors::Settings driven;
+            HvacPredictiveHeat::Settings predictive;
+        } predictiveHeat;
+#endif
+    };
+    uint8_t bytes[sizeof(HvacCommands::Settings) + sizeof(Largest)];
+}
+
+void HvacCommands::commitIfDue(msec_time_stamp_t now, bool force)
+{
+    if (!commitPending || (!force && now - commitRequestedAt < COMMIT_DEFER_MSEC))
+        return;
+    commitPending = false;
+    PROFILE_SCOPE(EEPROM_PUT);
+    auto t = ThermostatModeTypes[MyTypeNumber];
+    t->Snapshot(CommitSnapshot::bytes, true); // the settings as of the COMMIT...
+    t->CommitSettings();
+    t->Snapshot(CommitSnapshot::bytes, true); // ...and back to any changed since
+}
+
+void ThermostatCommon::loopCommit(msec_time_stamp_t now)
+{
+    HvacCommands::commitIfDue(now);
+}
+
 void ThermostatCommon::setup()
 {
+    ModeIndex::rebuild();
     uint8_t thermoType = EEPROM.read(HVAC_EEPROM_TYPE_AND_MODE_ADDR);
     uint8_t thermoMode = EEPROM.read(HVAC_EEPROM_TYPE_AND_MODE_ADDR+1);
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -989,40 +1576,43 @@ void ThermostatCommon::setup()
     }
 }
 
-bool HvacCommands::ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid, bool toMe)
+bool HvacCommands::ProcessCommand(const CommandView &cmd, uint8_t senderid)
 {
-    if (!toMe)
+    if (cmd.token != CMD_HVAC)
         return false;
 
-    static const char HVAC_COMMAND[] = "HVAC ";
-    static const char TYPE_COMMAND[] = "TYPE=";
-    static const char MODE_COMMAND[] = "MODE=";
-    static const char COUNT_COMMAND[] = "COUNT="; // WARNING. This command invalidates all previously saved eepromSettings!!!!
-    static const char COMMIT_COMMAND[] = " COMMIT";
-    static const char NAME_COMMAND[] = "NAME=";
+    enum { TYPE_FIELD, MODE_FIELD, COUNT_FIELD, COMMIT_FIELD, NAME_FIELD, NUM_FIELDS };
+    // WARNING. COUNT= invalidates all previously saved eepromSettings!!!!
+    static const char * const Fields[NUM_FIELDS] = { "TYPE=", "MODE=", "COUNT=", "COMMIT", "NAME=" };
 
-    const char* p = cmd;
-    const char* q = HVAC_COMMAND;
-    while (*q)
+    /* One pass over the words of args finds each field. found[] is
+    ** the character following the field's keyword, or null if absent. */
+    const char *found[NUM_FIELDS] = {};
+    for (const char *p = cmd.args; *p; p++)
     {
-        if (toupper(*p++) != *q++)
-            return false;
+        if (p != cmd.args && !isspace(p[-1]))
+            continue;
+        for (uint8_t i = 0; i < NUM_FIELDS; i++)
+        {
+            auto n = strlen(Fields[i]);
+            if (!found[i] && strncmp(p, Fields[i], n) == 0)
+                found[i] = p + n;
+        }
     }
 
+    const char* q;
     uint16_t hvacType(-1);
-    q = strstr(cmd, TYPE_COMMAND);
+    q = found[TYPE_FIELD];
     if (q)
     {
-        q += sizeof(TYPE_COMMAND) - 1;
         hvacType = aDecimalToInt(q);
         if (hvacType >= NUMBER_OF_HVAC_TYPES)
             return false;
     }
 
-    q = strstr(cmd, NAME_COMMAND);
+    q = found[NAME_FIELD];
     if (q)
     {
-        q += sizeof(NAME_COMMAND) - 1;
         char* name = settingsFromEeprom.ModeName;
         uint8_t count(0);
         while (*q && !isspace(*q) && count < NAME_LENGTH)
@@ -1039,17 +1629,18 @@ bool HvacCommands::ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid
         return true;
     }
 
-    q = strstr(cmd, COMMIT_COMMAND);
+    q = found[COMMIT_FIELD];
     if (q)
     {
-        q += sizeof(COMMIT_COMMAND) - 1;
         if (*q && !isspace(*q))
             return false;
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print(F("Commit MODE="));
         Serial.println(MyModeNumber);
 #endif
-        CommitSettings();
+        commitPending = true; // CommitSettings after COMMIT_DEFER_MSEC without another
+        commitRequestedAt = millis();
+        ThermostatModeTypes[MyTypeNumber]->Snapshot(CommitSnapshot::bytes, false);
         return true;
     }
 
@@ -1063,14 +1654,14 @@ bool HvacCommands::ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid
 
     auto tp = static_cast<HvacTypes>(hvacType);
 
-    q = strstr(cmd, MODE_COMMAND);
+    q = found[MODE_FIELD];
     if (q)
     {
-        q += sizeof(MODE_COMMAND) - 1;
         auto mode = aDecimalToInt(q);
         if (mode >= NumberOfModesInType(static_cast<HvacTypes>(hvacType)))
             return false;
 
+        commitIfDue(0, true); // a pending COMMIT is for the mode we're leaving, or we're asked to write it now
         if (MyModeNumber != mode || MyTypeNumber != static_cast<uint8_t>(hvacType))
         {
             MyModeNumber = mode;
@@ -1086,18 +1677,23 @@ bool HvacCommands::ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid
             hvac = temp = ThermostatModeTypes[hvacType];
             temp->InitializeState();
             temp->ReadSettings();
-            EEPROM.write(HVAC_EEPROM_TYPE_AND_MODE_ADDR, hvacType);
-            EEPROM.write(HVAC_EEPROM_TYPE_AND_MODE_ADDR+1, MyModeNumber);
+            EEPROM.update(HVAC_EEPROM_TYPE_AND_MODE_ADDR, hvacType);
+            EEPROM.update(HVAC_EEPROM_TYPE_AND_MODE_ADDR+1, MyModeNumber);
             temp->TurnFurnaceOff(); // turn furnace off now
         }
         return true;
     }
 
-    q = strstr(cmd, COUNT_COMMAND);
+    q = found[COUNT_FIELD];
     if (q)
     {
-        q += sizeof(COUNT_COMMAND) - 1;
         auto count = aDecimalToInt(q);
+        if (!ThermostatModeTypes[hvacType])
+            return false; // compiled out
+        if (count > 0xff || (tp != HVAC_PASSTHROUGH && ModeIndex::endWith(tp, count) > SetpointRing::START_ADDR))
+            return false; // the mode settings would run into the setpoint ring
+        commitIfDue(0, true);
+        SetpointRing::clear(hvacType + 1); // higher TYPEs are about to move in EEPROM
         SetNumberOfModesInType(tp, count);
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print(F("SetNumberOfModesInType tp="));
@@ -1114,15 +1710,23 @@ bool HvacCommands::ProcessCommand(const char* cmd, uint8_t len, uint8_t senderid
 HvacCommands::Settings HvacCommands::settingsFromEeprom = {
     {'P', 'A', 'S', 'S'}
 };
+bool HvacCommands::commitPending;
+msec_time_stamp_t HvacCommands::commitRequestedAt;
 
 uint8_t ThermostatCommon::MyModeNumber;
 uint8_t ThermostatCommon::MyTypeNumber;
-char ThermostatCommon::fanContinuous() { return MyTypeNumber >= static_cast<int>(HVAC_HEAT) ? (OverrideAndDriveFromSensors::fanContinuous() ? '1' : '0') : '-' ; }
+char ThermostatCommon::fanContinuous() { return isDrivenFromSensors(MyTypeNumber) ? (OverrideAndDriveFromSensors::fanContinuous() ? '1' : '0') : '-' ; }
 MapInputToOutput::Settings MapInputToOutput::settingsFromEeprom;
+#if HVAC_RULES_CLASS
+MapInputToOutputRules::Settings MapInputToOutputRules::settingsFromEeprom;
+#endif
 
 OverrideAndDriveFromSensors::Settings OverrideAndDriveFromSensors::settingsFromEeprom;
 msec_time_stamp_t OverrideAndDriveFromSensors::lastHeardFromSensor; 
-uint8_t OverrideAndDriveFromSensors::lastHeardSensorId;
+OverrideAndDriveFromSensors::SensorReading OverrideAndDriveFromSensors::sensorReadings[MAX_FUSED_SENSORS];
+uint8_t OverrideAndDriveFromSensors::sensorsHeard;
+bool OverrideAndDriveFromSensors::sensorsUpdated;
+msec_time_stamp_t OverrideAndDriveFromSensors::lastFusedDecision;
 msec_time_stamp_t OverrideAndDriveFromSensors::timeEnteredStage1; 
 OverrideAndDriveFromSensors::FurnaceState OverrideAndDriveFromSensors::fancoilState;
 bool OverrideAndDriveFromSensors::fanIsOn;
@@ -1130,6 +1734,14 @@ uint16_t OverrideAndDriveFromSensors::previousActual = 0;
 
 HvacCool::Settings HvacCool::settingsFromEeprom;
 
+#if HVAC_PREDICTIVE_CLASS
+HvacPredictiveHeat::Settings HvacPredictiveHeat::settingsFromEeprom;
+msec_time_stamp_t HvacPredictiveHeat::stageChangedAt;
+msec_time_stamp_t HvacPredictiveHeat::slopeStartTime;
+int16_t HvacPredictiveHeat::slopeStartCx10;
+bool HvacPredictiveHeat::haveSlopeStart;
+#endif
+
 #if HVAC_AUTO_CLASS
 HvacAuto::Settings HvacAuto::settingsFromEeprom;
 int16_t HvacAuto::autoTarget;
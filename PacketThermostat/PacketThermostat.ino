@@ -76,17 +76,104 @@ THE SOFTWARE. */
 #include <SerLCD.h>
 #include <SparkFun_RV8803.h>
 #include <avr/wdt.h>
+#include <util/atomic.h>
 
 // custom library
 #include <RadioConfiguration.h>
 #include "ThermostatCommon.h"
 #include "Rfm69RawFrequency.h"
+#if IDLE_SLEEP
+#include <avr/sleep.h>
+#endif
 
 #define ENABLE_OUTPUT_RELAYS 1  // for testing, the sketch can be built with outputs disabled.
 
 #define SCHEDULE_ENTRIES 1 // set to zero to remove this feature
+#define EVENT_LOG 1 // set to zero to remove the LOG command and its RAM
+#define RUNTIME_TOTALS 1 // set to zero to remove the RUNTIME command and its RAM
+#define EEPROM_IMAGE 1 // set to zero to remove the ER and EW commands
+#define OPTIMAL_START 1 // set to zero to fire schedule entries at their time regardless of recovery rates
+#if OPTIMAL_START && !SCHEDULE_ENTRIES
+#error OPTIMAL_START needs SCHEDULE_ENTRIES
+#endif
+
+namespace Deadlines {
+    /* The sketch's one-shot timers: the compressor and heat safety holds, the W relay's minimum on time
+    ** and the LCD's periodic resync. Each is armed with the millis() it expires and the function
+    ** to call then. The list is kept sorted soonest first, so a pass of loop() compares only
+    ** the head of the list against now. */
+    enum Id : uint8_t { COMPRESSOR_HOLD, HEAT_SAFETY_HOLD, W_RELAY_MINIMUM_ON, LCD_REINIT, NUM_DEADLINES };
+    typedef void (*Callback)(msec_time_stamp_t now);
+    struct Deadline {
+        msec_time_stamp_t at;
+        Callback fire;
+        uint8_t id;
+    };
+    Deadline list[NUM_DEADLINES]; // sorted by at, soonest first
+    uint8_t count;
+
+    uint8_t find(uint8_t id)
+    {   // returns count if id is not armed
+        uint8_t i = 0;
+        while (i < count && list[i].id != id)
+            i += 1;
+        return i;
+    }
+
+    void insert(const Deadline &d)
+    {   // ordered by the time remaining, which doesn't care about millis() rollover
+        const auto now = millis();
+        const long remaining = d.at - now;
+        uint8_t i = count++;
+        for (; i > 0 && static_cast<long>(list[i - 1].at - now) > remaining; i--)
+            list[i] = list[i - 1];
+        list[i] = d;
+    }
+
+    bool cancel(uint8_t id)
+    {
+        uint8_t i = find(id);
+        if (i == count)
+            return false;
+        count -= 1;
+        for (; i < count; i++)
+            list[i] = list[i + 1];
+        return true;
+    }
+
+    void arm(uint8_t id, msec_time_stamp_t at, Callback fire)
+    {   // replaces the deadline id if it is already armed
+        cancel(id);
+        Deadline d = { at, fire, id };
+        insert(d);
+    }
+
+    void moveTo(uint8_t id, msec_time_stamp_t at)
+    {   // same callback, new time. Nothing happens if id is not armed
+        uint8_t i = find(id);
+        if (i == count)
+            return;
+        Deadline d = list[i];
+        d.at = at;
+        cancel(id);
+        insert(d);
+    }
+
+    void loop(msec_time_stamp_t now)
+    {
+        while (count != 0 && static_cast<long>(now - list[0].at) >= 0)
+        {
+            auto fire = list[0].fire;
+            cancel(list[0].id);
+            fire(now); // may arm again
+        }
+    }
+}
 
 namespace LCD {
+    /* The print functions only write into frame. loop() compares frame against what was
+    ** last sent to the glass, and sends at most one short run of changed cells per pass so
+    ** that no single loop() pass holds the qwiic bus for long. */
     const byte MODE_COLUMN = 0;
     const byte MODE_ROW = 0;
     const byte TIME_COLUMN = 0;
@@ -98,13 +185,27 @@ namespace LCD {
     const byte HVAC_COMPRESSORHOLD_ROW = 0;
     const byte HVAC_COMPRESSORHOLD_COLUMN = 15;
 
+    const byte ROWS = 2;
+    const byte COLUMNS = 16;
+    const byte MAX_CELLS_PER_WRITE = 8;
+    const char UNKNOWN_CELL = 0; // never in frame, so forces that cell to be sent
+
     SerLCD lcd;
+    char frame[ROWS][COLUMNS]; // what we want on the glass
+    char glass[ROWS][COLUMNS]; // what we have sent to the glass
+
+    const int BANNER_TIME_MSEC = 2000;
+    const char *banner; // when not null, covers frame for BANNER_TIME_MSEC
+    unsigned long bannerStart;
 
     const long WHEN_TO_REINIT_INTERVAL_MSEC = 60000 * 3; // 3 minutes
-    unsigned long whenToReinit;
 
     void backlightOK() { lcd.setBacklight(64, 64, 64);  }
 
+    void clear() { memset(frame, ' ', sizeof(frame)); }
+
+    void reinitDue(msec_time_stamp_t now);
+
     void init()
     {
         lcd.begin(Wire);
@@ -114,38 +215,41 @@ namespace LCD {
         lcd.noCursor();
         lcd.noBlink();
         lcd.noAutoscroll();
-        whenToReinit = millis() + WHEN_TO_REINIT_INTERVAL_MSEC;
+        clear();
+        memcpy(glass, frame, sizeof(glass));
+        Deadlines::arm(Deadlines::LCD_REINIT, millis() + WHEN_TO_REINIT_INTERVAL_MSEC, reinitDue);
+    }
+
+    void print(byte column, byte row, const char *p)
+    {
+        while (*p && column < COLUMNS)
+            frame[row][column++] = *p++;
     }
 
     void printMode(const char *m)
     {
-        lcd.setCursor(MODE_COLUMN, MODE_ROW);
-        lcd.write(m);
-        lcd.write(' ');
+        print(MODE_COLUMN, MODE_ROW, m);
+        print(MODE_COLUMN + strlen(m), MODE_ROW, " ");
     }
 
     void printTime(const char *t)
     {
-        lcd.setCursor(TIME_COLUMN, TIME_ROW);
-        lcd.write(t);
+        print(TIME_COLUMN, TIME_ROW, t);
     }
 
     void printTemperatures(const char *t)
     {
-        lcd.setCursor(HVAC_TEMPERATURES_COLUMN, HVAC_TEMPERATURES_ROW);
-        lcd.write(t);
+        print(HVAC_TEMPERATURES_COLUMN, HVAC_TEMPERATURES_ROW, t);
     }
 
     void printOutputs(const char *p)
     {
-        lcd.setCursor(HVAC_COLUMN, HVAC_ROW);
-        lcd.write(p);
+        print(HVAC_COLUMN, HVAC_ROW, p);
     }
 
     void printCompressorHold(const char *p)
     {
-        lcd.setCursor(HVAC_COMPRESSORHOLD_COLUMN, HVAC_COMPRESSORHOLD_ROW);
-        lcd.write(p);
+        print(HVAC_COMPRESSORHOLD_COLUMN, HVAC_COMPRESSORHOLD_ROW, p);
     }
 
     enum {BACKLIGHT_UNKNOWN, BACKLIGHT_OFF, BACKLIGHT_ON} backlightShowMissing24V;
@@ -158,7 +262,7 @@ namespace LCD {
             if (backlightShowMissing24V != BACKLIGHT_ON)
             {
                 backlightOK();
-                lcd.clear();
+                clear();
                 reinit = true;
             }
             backlightShowMissing24V = BACKLIGHT_ON;
@@ -166,31 +270,66 @@ namespace LCD {
             if (backlightShowMissing24V != BACKLIGHT_OFF)
             {
                 lcd.setBacklight(255, 0, 0);
-                lcd.clear();
+                clear();
                 reinit = true;
             }
             backlightShowMissing24V = BACKLIGHT_OFF;
         }
     }
 
-    const int BANNER_TIME_MSEC = 2000;
     void printBanner(const char *p)
-    {
-        lcd.clear();
-        lcd.write(p);
-        delay(BANNER_TIME_MSEC);
+    {   // p must stay valid for BANNER_TIME_MSEC. It is laid out as lcd.write would: wrapping onto the second row
+        banner = p;
+        bannerStart = millis();
     }
 
-    void loop(unsigned long now)
+    char cellToShow(byte row, byte column, byte bannerLength)
     {
-        if (now - whenToReinit > WHEN_TO_REINIT_INTERVAL_MSEC)
+        if (!banner)
+            return frame[row][column];
+        byte i = row * COLUMNS + column;
+        return i < bannerLength ? banner[i] : ' ';
+    }
+
+    void flush()
+    {   // send the first run of changed cells, if any, to the glass
+        byte bannerLength = banner ? strnlen(banner, ROWS * COLUMNS) : 0;
+        for (byte row = 0; row < ROWS; row++)
         {
-            whenToReinit = now;
-            lcd.clear();
-            reinit = true;
-            backlightShowMissing24V = BACKLIGHT_UNKNOWN;
+            for (byte column = 0; column < COLUMNS; column++)
+            {
+                if (cellToShow(row, column, bannerLength) == glass[row][column])
+                    continue;
+                // include unchanged cells between changed ones rather than pay for another setCursor
+                byte last = column;
+                for (byte c = column + 1; c < COLUMNS && c < column + MAX_CELLS_PER_WRITE; c++)
+                    if (cellToShow(row, c, bannerLength) != glass[row][c])
+                        last = c;
+                for (byte c = column; c <= last; c++)
+                    glass[row][c] = cellToShow(row, c, bannerLength);
+                PROFILE_SCOPE(LCD_WRITE);
+                lcd.setCursor(column, row);
+                lcd.write(reinterpret_cast<const uint8_t *>(&glass[row][column]), last + 1 - column);
+                return;
+            }
         }
     }
+
+    void reinitDue(msec_time_stamp_t now)
+    {   // the LCD display seems to get out of sync. Force a full update of it occasionally
+        Deadlines::arm(Deadlines::LCD_REINIT, now + WHEN_TO_REINIT_INTERVAL_MSEC, reinitDue);
+        clear();
+        memset(glass, UNKNOWN_CELL, sizeof(glass));
+        reinit = true;
+        backlightShowMissing24V = BACKLIGHT_UNKNOWN;
+    }
+
+    void loop(unsigned long now)
+    {
+        if (banner && now - bannerStart >= BANNER_TIME_MSEC)
+            banner = 0;
+        flush();
+    }
 }
 
 namespace
@@ -216,6 +355,7 @@ namespace
     static_assert(sizeof(ScheduleEntry_t) == 4, "EEPROM size changed!");
     const int NUM_SCHEDULE_TEMPERATURE_ENTRIES = 16;
 #endif
+    const int NUM_OPTIMAL_START_TYPES = 8; // a learned rate for each HVAC TYPE below this
     enum class EepromAddresses {PACKET_THERMOSTAT_START = RadioConfiguration::EepromAddresses::TOTAL_EEPROM_USED,
                 SIGNAL_LABEL_ASSIGNMENT = PACKET_THERMOSTAT_START,
                 DISPLAY_UNITS_ADDRESS = SIGNAL_LABEL_ASSIGNMENT + (OutregBits::NUMBER_OF_SIGNALS * MAX_WIRE_NAME_LEN),
@@ -226,10 +366,14 @@ namespace
                 HEATSAFETY_MAP = HEATSAFETY_TRIGGER_TEMPERATURECx10 + 2,
                 SCHEDULE_TEMPERATURE_ENTRIES = HEATSAFETY_MAP + NUM_HEAT_SAFETY_ENTRIES * sizeof(HeatSafetyMask_t),
 #if SCHEDULE_ENTRIES
-                TOTAL_EEPROM_USED = SCHEDULE_TEMPERATURE_ENTRIES + NUM_SCHEDULE_TEMPERATURE_ENTRIES * sizeof(ScheduleEntry_t)
+                TELEMETRY_FORMAT = SCHEDULE_TEMPERATURE_ENTRIES + NUM_SCHEDULE_TEMPERATURE_ENTRIES * sizeof(ScheduleEntry_t),
 #else
-                TOTAL_EEPROM_USED = SCHEDULE_TEMPERATURE_ENTRIES
+                TELEMETRY_FORMAT = SCHEDULE_TEMPERATURE_ENTRIES,
 #endif
+                GROUP_ID = TELEMETRY_FORMAT + 1,
+                OPTIMAL_START_RATES, // reserved with OPTIMAL_START 0 too, so HVAC_EEPROM_START doesn't follow the flag
+                LAYOUT_VERSION = OPTIMAL_START_RATES + NUM_OPTIMAL_START_TYPES, // see EepromLayout
+                TOTAL_EEPROM_USED = LAYOUT_VERSION + 2
     };
 
     // Arduino pin assignments **********************************************************
@@ -277,6 +421,7 @@ namespace
     const int CMD_BUFLEN = 80;
 
     const int INPUT_AC_ACTIVE_MIN_MSEC = 100; // this long seen nothing on input, declare it OFF
+    const uint16_t INPUT_SAMPLE_HZ = 960; // 16 samples per 60Hz cycle. Sampled in the Timer3 interrupt
 
     // enum OutregBits applies to both the input and output registers
     uint8_t OutputRegister = 0;
@@ -284,11 +429,13 @@ namespace
     bool InputsToHvacFlag;
     msec_time_stamp_t CompressorOffStartTime;
     bool CompressorOffTimeActive;
+    uint16_t CompressorHoldSeconds; // RAM copies of the EEPROM settings
+    uint16_t HeatSafetyHoldSeconds;
     msec_time_stamp_t HeatSafetyOffStartTime;
     uint8_t HeatSafetyShutoffMask;
     bool HeatSafetyOffTimeActive;
     const char * const HeatSafetyBanner = "OVER!";
-    int16_t TinletTemperatureCx10; // last calculated copy of TinleADCsum
+    int16_t TinletTemperatureCx10; // last calculated copy of TinletADCx64
 
     char cmdbuf[CMD_BUFLEN];
     unsigned char charsInBuf;
@@ -298,29 +445,76 @@ namespace
     const uint8_t GATEWAY_NODEID = 1;
 
     RV8803 rtc;
+    bool lcdClockResync = true; // taskLcdClock reads the RTC on its next pass instead of at the minute rollover
+
+    void updateRtcTime()
+    {   // taskLcdClock reads the RTC only once a minute, so anything wanting the seconds reads it itself
+        PROFILE_SCOPE(RTC_UPDATE);
+        rtc.updateTime();
+    }
 
-    const double ADCmaxVoltage = 3.3; // supply voltage is 3.3V
+    constexpr double ADCmaxVoltage = 3.3; // supply voltage is 3.3V
     const unsigned ADCmaxVoltageCount = 1024;         // ADC is 10 bits, which means 3.3V <-> 1024 counts 
+    // The temperature conversions take the ADC reading scaled by 64, the 6 fractional bits of the filter below
     const int POWER2_ADC_READS_TO_AVERAGE = 6;
     const int NUMBER_TEMPERATURE_ADC_READS_TO_AVERAGE = 1 << POWER2_ADC_READS_TO_AVERAGE; // 2**6 = 64
 
-    const uint16_t POLL_ADC_MSEC = 1000;  // 1000 msec between reads, times 64 is (about) 64 seconds
-    const uint16_t BETWEEN_REPORTING_TEMPERTURE_MSEC = 60 * 1000 * 3; // 3 minutes
-    uint16_t TinletADCsum; // 10 bit ADC summed 64 times just fits here
-    uint16_t ToutletADCsum;
-    uint16_t TexternalADCsum;
-    uint8_t numberReadsInSum;
+    /* Each ADC channel is an exponential moving average of AdcEngine's blocks, updated every POLL_ADC_MSEC:
+    **      avg += (reading - avg) / 2**POWER2_ADC_FILTER
+    ** which follows a step change about 63% of the way in 16 reads. */
+    const uint16_t POLL_ADC_MSEC = 1000;
+    const int POWER2_ADC_FILTER = 4;
+    const int16_t REPORT_TEMPERATURE_CHANGE_Cx10 = 3; // report when any channel moves this much...
+    const uint32_t MIN_BETWEEN_REPORTING_TEMPERATURE_MSEC = 30 * 1000L; // ...but no more often than this
+    const uint32_t BETWEEN_REPORTING_TEMPERTURE_MSEC = 60 * 1000L * 10; // report at least this often regardless
+    uint16_t TinletADCx64; // 10 bit ADC times 64 just fits here
+    uint16_t ToutletADCx64;
+    uint16_t TexternalADCx64;
     bool displayLcdFarenheit;
+    bool binaryTelemetry; // TF=B command. Else the ASCII reports
+
+    /* GRP <sequence> <command> packets go to many units at once: to RF69_BROADCAST_ADDR, or to
+    ** this unit's group ID, a node ID no unit has that GROUP= assigns to several. They are never
+    ** ACKed, so the gateway sends each one a few times, and the sequence number makes the repeats
+    ** cheap to ignore. */
+    uint8_t groupId; // GROUP= command. zero for none
+    uint16_t lastGroupSequence;
+    bool haveGroupSequence;
+
+    /* Binary telemetry packets. Little endian, as the 32U4 lays them out.
+    ** The first byte distinguishes them from the ASCII reports, which are all printable. */
+    const int16_t TELEMETRY_NO_TEMPERATURE = -32767 - 1; // 0x8000. target & actual when the HVAC type has none
+    struct TemperatureTelemetry_t {
+        uint8_t tag; // TELEMETRY_TEMPERATURE_TAG
+        int16_t inletCx10;
+        int16_t outletCx10;
+        int16_t outsideCx10;
+        int16_t targetCx10;
+        int16_t actualCx10;
+        uint8_t typeNumber;
+        uint8_t modeNumber;
+        char fanContinuous; // same as the ASCII report: '0', '1' or '-'
+    } __attribute__((packed));
+    struct HvacTelemetry_t {
+        uint8_t tag; // TELEMETRY_HVAC_TAG
+        uint8_t inputs;
+        uint8_t outputs;
+        uint8_t typeNumber;
+        uint8_t modeNumber;
+        uint32_t epochSeconds; // since 1970
+    } __attribute__((packed));
+    const uint8_t TELEMETRY_TEMPERATURE_TAG = 1;
+    const uint8_t TELEMETRY_HVAC_TAG = 2;
+    static_assert(sizeof(TemperatureTelemetry_t) == 14, "telemetry layout changed!");
+    static_assert(sizeof(HvacTelemetry_t) == 9, "telemetry layout changed!");
 
     // The Honeywell C7089U temperature dependent resistor is supported
-    const unsigned NUM_C7089_COEFFICIENTS = 75;
-    struct C7089UCoefficient_t {
-        int16_t TCelsiusX10;
-        uint16_t ADCx64; // corresponding ADC value, multiplied by 64
-        uint16_t slope;
-    };
-    extern const C7089UCoefficient_t C7089UCoefficients[NUM_C7089_COEFFICIENTS]  PROGMEM;
-    const int POWER2_C7089SlopeScale = 18;
+    // The table has its temperature at uniformly spaced ADCx64 values, so the top bits of the ADC index it
+    const int POWER2_C7089U_TABLE_STEP = 9; // 512 ADCx64. That is 8 ADC counts
+    const unsigned NUM_C7089U_TABLE_ENTRIES = (0x10000ul >> POWER2_C7089U_TABLE_STEP) + 1; // one extra to interpolate past the last
+    extern const int16_t C7089UTable[NUM_C7089U_TABLE_ENTRIES] PROGMEM; // TCelsiusX10
+    extern const uint16_t C7089U_MIN_ADCx64; // hottest temperature in the Honeywell data
+    extern const uint16_t C7089U_MAX_ADCx64; // coldest
     static char reportbuf[sizeof(radio.DATA) + 1];
 
     void radioPrintInfo()
@@ -339,6 +533,107 @@ namespace
 #endif
     }
 
+    namespace RadioQueue {
+        /* radio.sendWithRetry blocks loop() for as long as its ACK timeouts take while the gateway is busy.
+        ** Instead, outgoing packets are queued here, with one slot for each class of packet, and
+        ** loop() calls RadioQueue::loop() to advance a state machine: send, wait for ACK, retry with 
+        ** a doubling wait, else give up. A newer packet of a class replaces the older, not yet 
+        ** acknowledged one, so only the latest state report goes out. */
+        enum PacketClass { PACKET_HVAC, PACKET_RESPONSE, PACKET_TEMPERATURE, NUMBER_OF_PACKET_CLASSES}; // lower number sends first
+
+        const uint8_t SEND_RETRIES = 2; // same as sendWithRetry's default
+        // sendWithRetry's default ACK wait, but sendWithRetry waits that long every time. Doubling it on
+        // each retry is deliberate: the wait no longer blocks loop(), and a busy gateway gets 40, 80 and 160 msec
+        const uint8_t FIRST_ACK_WAIT_MSEC = 40;
+
+        struct Slot {
+            uint8_t len; // zero means empty
+            char data[sizeof(radio.DATA)];
+        };
+        Slot slots[NUMBER_OF_PACKET_CLASSES];
+
+        enum { SEND_IDLE, SEND_WAIT_ACK } sendState;
+        uint8_t sendingClass;
+        uint8_t sendAttempts;
+        uint8_t ackWaitMsec;
+        bool replacedWhileSending; // a newer packet arrived while waiting for the ACK of the older
+        msec_time_stamp_t sentAtTime;
+
+        void enqueue(PacketClass c, const char *p, uint8_t len)
+        {
+            if (len > sizeof(slots[c].data))
+                len = sizeof(slots[c].data);
+            memcpy(slots[c].data, p, len);
+            slots[c].len = len;
+            if (sendState != SEND_IDLE && sendingClass == c)
+                replacedWhileSending = true;
+        }
+
+        void send(msec_time_stamp_t now)
+        {
+            const Slot &s = slots[sendingClass];
+            PROFILE_SCOPE(RADIO_SEND);
+            radio.send(GATEWAY_NODEID, s.data, s.len, true);
+            sendAttempts += 1;
+            sentAtTime = now;
+            sendState = SEND_WAIT_ACK;
+        }
+
+        void done()
+        {
+            if (!replacedWhileSending)
+                slots[sendingClass].len = 0;
+            sendState = SEND_IDLE;
+        }
+
+        bool isAckForMe()
+        {   // call when radio.receiveDone(). Returns true if the packet was the ACK of our send
+            if (!radio.ACK_RECEIVED || radio.SENDERID != GATEWAY_NODEID || 
+                    radio.TARGETID != radioConfiguration.NodeId())
+                return false;
+            if (sendState == SEND_WAIT_ACK)
+                done();
+            return true;
+        }
+
+        void loop(msec_time_stamp_t now)
+        {
+            if (sendState == SEND_IDLE)
+            {
+                uint8_t c = 0;
+                while (c < NUMBER_OF_PACKET_CLASSES && slots[c].len == 0)
+                    c += 1;
+                if (c >= NUMBER_OF_PACKET_CLASSES || !radio.canSend())
+                    return;
+                sendingClass = c;
+                sendAttempts = 0;
+                ackWaitMsec = FIRST_ACK_WAIT_MSEC;
+                replacedWhileSending = false;
+                send(now);
+            }
+            else if (now - sentAtTime >= ackWaitMsec)
+            {   // no ACK
+                if (replacedWhileSending)
+                {   // start over with the newer packet
+                    sendState = SEND_IDLE;
+                    return;
+                }
+                if (sendAttempts > SEND_RETRIES)
+                {
+#if USE_SERIAL >= SERIAL_PORT_VERBOSE
+                    Serial.println(F("Radio: no ACK"));
+#endif
+                    done();
+                }
+                else if (radio.canSend())
+                {
+                    ackWaitMsec <<= 1;
+                    send(now);
+                }
+            }
+        }
+    }
+
     char *tempToAscii(char *p, int16_t temperatureX10)
     {
         itoa(temperatureX10, p, 10);
@@ -421,24 +716,31 @@ namespace
     void setCompressorMask(uint8_t mask)
     {
             int addr = static_cast<uint16_t>(EepromAddresses::COMPRESSOR_MASK);
-            EEPROM.write(addr, mask);
+            EEPROM.update(addr, mask);
     }
 
     void setCompressorHoldSeconds(uint16_t s)
     {
         int addr = static_cast<uint16_t>(EepromAddresses::COMPRESSOR_HOLD_SECONDS);
+        PROFILE_SCOPE(EEPROM_PUT);
         EEPROM.put(addr, s);
+        CompressorHoldSeconds = s;
+        Deadlines::moveTo(Deadlines::COMPRESSOR_HOLD, CompressorOffStartTime + 1000L * s);
     }
 
     void setHeatSafetyHoldSeconds(uint16_t s)
     {
         int addr = static_cast<uint16_t>(EepromAddresses::HEATSAFETY_HOLD_SECONDS);
+        PROFILE_SCOPE(EEPROM_PUT);
         EEPROM.put(addr, s);
+        HeatSafetyHoldSeconds = s;
+        Deadlines::moveTo(Deadlines::HEAT_SAFETY_HOLD, HeatSafetyOffStartTime + 1000L * s);
     }
 
     void setHeatSafetyTemperatureX10(int16_t s)
     {
         int addr = static_cast<uint16_t>(EepromAddresses::HEATSAFETY_TRIGGER_TEMPERATURECx10);
+        PROFILE_SCOPE(EEPROM_PUT);
         EEPROM.put(addr, s);
     }
 
@@ -447,6 +749,7 @@ namespace
         if (which < NUM_HEAT_SAFETY_ENTRIES)
         {
             int addr = static_cast<uint16_t>(EepromAddresses::HEATSAFETY_MAP)  + which * sizeof(m);
+            PROFILE_SCOPE(EEPROM_PUT);
             EEPROM.put(addr, m);
         }
     }
@@ -457,6 +760,7 @@ namespace
         if (which < NUM_SCHEDULE_TEMPERATURE_ENTRIES)
         {
             int addr = static_cast<uint16_t>(EepromAddresses::SCHEDULE_TEMPERATURE_ENTRIES) + which * sizeof(se);
+            PROFILE_SCOPE(EEPROM_PUT);
             EEPROM.put(addr, se);
         }
     }
@@ -472,6 +776,483 @@ namespace
         }
         return ret;
     }
+
+    namespace ScheduleIndex {
+        /* A RAM copy of the schedule entries that have any day of the week set, sorted by time of day.
+        ** SE rebuilds it. taskSchedule reads the RTC only when the next entry is due (or MAX_SLEEP_MINUTES
+        ** have passed) and fires every entry from the last minute it checked through the current one. So
+        ** a late wakeup neither misses an entry nor fires it twice, and there is no EEPROM read at run time. */
+        const uint16_t MINUTES_PER_DAY = 24 * 60;
+        const uint16_t MINUTES_PER_WEEK = 7 * MINUTES_PER_DAY;
+        const uint8_t MAX_SLEEP_MINUTES = 15; // bounds how far millis() may drift from the RTC before a wakeup
+
+        ScheduleEntry_t sorted[NUM_SCHEDULE_TEMPERATURE_ENTRIES];
+        uint8_t count;
+        uint16_t checkedThrough; // minute of the week
+        bool resync = true; // the next wakeup starts from the RTC's minute without firing anything
+        msec_time_stamp_t wakeAt;
+
+        uint16_t minuteOfDay(const ScheduleEntry_t& se)
+        {
+            return static_cast<uint16_t>(se.TimeOfDayHour) * 60 + static_cast<uint16_t>(se.TimeOfDayMinute);
+        }
+
+        void rebuild()
+        {   // insertion sort. Entries at the same minute stay in table order
+            count = 0;
+            for (uint8_t i = 0; i < NUM_SCHEDULE_TEMPERATURE_ENTRIES; i++)
+            {
+                auto se = getScheduleEntry(i);
+                if (se.DaysOfWeek == 0)
+                    continue;
+                uint8_t j = count++;
+                for (; j > 0 && minuteOfDay(sorted[j - 1]) > minuteOfDay(se); j--)
+                    sorted[j] = sorted[j - 1];
+                sorted[j] = se;
+            }
+            resync = true;
+        }
+
+        uint16_t minutesUntilNext(uint16_t from)
+        {   // 1 through MINUTES_PER_WEEK to the first entry after minute of the week "from". zero if there is none
+            uint8_t day = from / MINUTES_PER_DAY;
+            uint16_t minute = from % MINUTES_PER_DAY;
+            for (uint8_t d = 0; d <= 7; d++)
+            {
+                uint8_t dayMask = 1 << ((day + d) % 7);
+                for (uint8_t i = 0; i < count; i++)
+                {
+                    uint16_t m = minuteOfDay(sorted[i]);
+                    if (d == 0 && m <= minute)
+                        continue;
+                    if (d == 7 && m > minute)
+                        break;
+                    if (static_cast<uint8_t>(sorted[i].DaysOfWeek) & dayMask)
+                        return d * MINUTES_PER_DAY + m - minute;
+                }
+            }
+            return 0;
+        }
+    }
+#endif
+
+#if OPTIMAL_START
+    namespace OptimalStart {
+        /* A schedule entry that moves the target away from the actual temperature, a morning warmup for
+        ** example, fires early enough that the house arrives at the new target at the entry's time.
+        ** The lead time comes from a recovery rate learned for each HVAC TYPE: minutes to move the actual
+        ** temperature one degree C with the mode's own staging. A schedule change of at least
+        ** MIN_RECOVERY_Cx10 that turns on an output and then reaches its target updates the rate, so
+        ** a setback the house drifts down to is not learned. Each rate is a byte in EEPROM, with
+        ** RISING set if it was learned heating, and only entries in that direction start early. */
+        const uint8_t UNKNOWN = 0xff; // erased EEPROM. nothing learned yet
+        const uint8_t DISABLED = 0;   // OS <type> 0. never starts early, and never learns
+        const uint8_t RISING = 0x80;
+        const uint8_t MINUTES_MASK = 0x7f;
+        const int16_t MIN_RECOVERY_Cx10 = 5;
+        const uint16_t MAX_LEAD_MINUTES = 180;
+        const uint32_t MAX_RECOVERY_MSEC = 4 * 60 * 60000UL; // slower than this isn't a recovery to learn from
+        const uint16_t NO_MINUTE = 0xffff;
+
+        struct Recovery_t {
+            bool active;
+            bool driven; // an output came on that wasn't on at the start
+            uint8_t type;
+            uint8_t mode;
+            uint8_t outputsAtStart;
+            int16_t fromCx10;
+            int16_t targetCx10;
+            msec_time_stamp_t startedAt;
+        };
+        Recovery_t recovery;
+        uint16_t earlyMinute = NO_MINUTE; // minute of the week whose entries already fired early
+
+        uint8_t rate(uint8_t type)
+        {
+            if (type >= NUM_OPTIMAL_START_TYPES)
+                return DISABLED;
+            return EEPROM.read(static_cast<int>(EepromAddresses::OPTIMAL_START_RATES) + type);
+        }
+
+        void setRate(uint8_t type, uint8_t r)
+        {
+            if (type < NUM_OPTIMAL_START_TYPES)
+                EEPROM.update(static_cast<int>(EepromAddresses::OPTIMAL_START_RATES) + type, r);
+        }
+
+        bool actualCx10(int16_t &targetCx10, int16_t &actual)
+        {   // false if the TYPE has no actual temperature, or no sensor has reported yet
+            return hvac->GetTargetAndActual(targetCx10, actual) && actual != 0;
+        }
+
+        void started(int16_t targetCx10)
+        {   // a schedule entry just set the target
+            int16_t t, actual;
+            recovery.active = false;
+            if (!actualCx10(t, actual) || abs(targetCx10 - actual) < MIN_RECOVERY_Cx10)
+                return;
+            recovery.active = true;
+            recovery.driven = false;
+            recovery.type = hvac->TypeNumber();
+            recovery.mode = hvac->ModeNumber();
+            recovery.outputsAtStart = OutputRegister;
+            recovery.fromCx10 = actual;
+            recovery.targetCx10 = targetCx10;
+            recovery.startedAt = millis();
+        }
+
+        void watch(msec_time_stamp_t now)
+        {   // learn from the recovery in progress, if any, once it reaches its target
+            if (!recovery.active)
+                return;
+            int16_t t, actual;
+            if (!actualCx10(t, actual) || t != recovery.targetCx10 ||
+                hvac->TypeNumber() != recovery.type || hvac->ModeNumber() != recovery.mode ||
+                now - recovery.startedAt > MAX_RECOVERY_MSEC)
+            {   // someone changed the target or the mode, or it is not recovering
+                recovery.active = false;
+                return;
+            }
+            if (OutputRegister & ~recovery.outputsAtStart)
+                recovery.driven = true;
+            bool rising = recovery.targetCx10 > recovery.fromCx10;
+            if (rising ? actual < recovery.targetCx10 : actual > recovery.targetCx10)
+                return;
+            recovery.active = false;
+            uint8_t r = rate(recovery.type);
+            if (r == DISABLED || !recovery.driven)
+                return;
+            // msec / 6000 is tenths of minutes, and per Cx10 that is minutes per degree C
+            uint32_t learned = (now - recovery.startedAt) / 6000 / abs(recovery.targetCx10 - recovery.fromCx10);
+            if (r != UNKNOWN && ((r & RISING) != 0) == rising)
+                learned = (3u * (r & MINUTES_MASK) + learned + 2) / 4; // 1/4 weight to each new recovery
+            if (learned < 1)
+                learned = 1;
+            else if (learned >= MINUTES_MASK)
+                learned = MINUTES_MASK - 1; // MINUTES_MASK with RISING would be UNKNOWN
+            setRate(recovery.type, static_cast<uint8_t>(learned) | (rising ? RISING : 0));
+        }
+
+        uint16_t leadMinutes(uint16_t minuteOfWeek)
+        {   // how early to fire the entries due at minuteOfWeek. zero unless they start a recovery
+            using namespace ScheduleIndex;
+            int16_t t, actual;
+            uint8_t r = rate(hvac->TypeNumber());
+            if (r == UNKNOWN || r == DISABLED || !actualCx10(t, actual))
+                return 0;
+            uint8_t dayMask = 1 << (minuteOfWeek / MINUTES_PER_DAY);
+            uint16_t minute = minuteOfWeek % MINUTES_PER_DAY;
+            uint16_t lead = 0;
+            for (uint8_t i = 0; i < count; i++)
+                if (minuteOfDay(sorted[i]) == minute && (static_cast<uint8_t>(sorted[i].DaysOfWeek) & dayMask))
+                {
+                    if (sorted[i].AutoMode)
+                        return 0; // two targets. leave it on time
+                    int16_t newCx10 = static_cast<int16_t>(sorted[i].degreesCx5) << 1;
+                    int16_t gap = newCx10 - actual;
+                    // a recovery moves the target beyond both the actual and the current target,
+                    // in the direction the rate was learned
+                    if ((gap > 0) != ((r & RISING) != 0) || (gap > 0 ? newCx10 <= t : newCx10 >= t))
+                        continue;
+                    uint32_t m = static_cast<uint32_t>(abs(gap)) * (r & MINUTES_MASK) / 10;
+                    if (m > lead)
+                        lead = m > MAX_LEAD_MINUTES ? MAX_LEAD_MINUTES : m;
+                }
+            return lead;
+        }
+    }
+#endif
+
+#if EVENT_LOG
+    namespace EventLog {
+        /* The latest NUM_EVENTS state changes, kept in RAM so the gateway can backfill the telemetry
+        ** it missed. Every event gets the next 16 bit sequence number. LOG <seq> replies with one
+        ** LogPacket_t holding the oldest events still here at or after seq, and the sequence number
+        ** the next event will get, so the gateway repeats LOG until it has caught up. */
+        struct Event_t {
+            uint32_t epochSeconds; // since 1970
+            uint8_t what; // the inputs (which are less than EVENT_MODE), or one of the EVENT_ values below
+            uint8_t value; // the outputs, the mode number, or 1 for start and 0 for end
+        } __attribute__((packed));
+        static_assert(sizeof(Event_t) == 6, "LOG layout changed!");
+        static_assert(INPUT_SIGNAL_MASK < 0x80, "inputs must not look like an EVENT_ value");
+        const uint8_t EVENT_MODE = 0x80; // ORed with the HVAC type number
+        const uint8_t EVENT_COMPRESSOR_HOLD = 0x90;
+        const uint8_t EVENT_HEAT_SAFETY = 0xA0;
+
+        const uint8_t NUM_EVENTS = 32; // must be a power of 2
+        const uint8_t EVENTS_PER_PACKET = 9;
+        struct LogPacket_t {
+            char tag[2]; // "LG"
+            uint16_t firstSequence; // of events[0]. Later than requested means events were lost
+            uint16_t nextSequence;
+            Event_t events[EVENTS_PER_PACKET]; // only firstSequence up to nextSequence are sent
+        } __attribute__((packed));
+        static_assert(sizeof(LogPacket_t) <= RF69_MAX_DATA_LEN, "LogPacket_t must fit a radio packet");
+
+        Event_t events[NUM_EVENTS];
+        uint16_t nextSequence;
+        uint8_t numEvents;
+
+        void add(uint8_t what, uint8_t value)
+        {
+            Event_t &e = events[nextSequence & (NUM_EVENTS - 1)];
+            updateRtcTime();
+            e.epochSeconds = rtc.getEpoch(true);
+            e.what = what;
+            e.value = value;
+            nextSequence += 1;
+            if (numEvents < NUM_EVENTS)
+                numEvents += 1;
+        }
+
+        void send(uint16_t from)
+        {
+            LogPacket_t lp;
+            lp.tag[0] = 'L'; lp.tag[1] = 'G';
+            uint16_t oldest = nextSequence - numEvents;
+            if (static_cast<uint16_t>(from - oldest) > numEvents)
+                from = oldest; // overwritten, or not yet logged
+            lp.firstSequence = from;
+            lp.nextSequence = nextSequence;
+            uint8_t n = 0;
+            for (; n < EVENTS_PER_PACKET && from != nextSequence; n++, from++)
+            {
+                lp.events[n] = events[from & (NUM_EVENTS - 1)];
+#if USE_SERIAL >= SERIAL_PORT_DEBUG
+                Serial.print(from); Serial.print(' ');
+                Serial.print(lp.events[n].epochSeconds); Serial.print(' ');
+                Serial.print(lp.events[n].what, HEX); Serial.print(' ');
+                Serial.println(lp.events[n].value, HEX);
+#endif
+            }
+            if (radioSetupOK)
+                RadioQueue::enqueue(RadioQueue::PACKET_RESPONSE, reinterpret_cast<const char *>(&lp),
+                    sizeof(lp) - sizeof(lp.events) + n * sizeof(Event_t));
+        }
+    }
+#endif
+
+#if RUNTIME_TOTALS
+    namespace Runtime {
+        /* On time and on count of each output, updated only when Furnace::UpdateOutputs changes
+        ** an output. taskLcdClock passes in the RTC hour, and a new hour rolls THIS_HOUR into LAST_HOUR
+        ** and TODAY, and a new day rolls TODAY into YESTERDAY. RUNTIME <period> sends one period. */
+        enum Period { THIS_HOUR, LAST_HOUR, TODAY, YESTERDAY, NUMBER_OF_PERIODS };
+        const uint8_t NUM_OUTPUTS = NUMBER_OF_SIGNALS - BN_FIRST_SIGNAL; // Z2 through X3. Not the W failsafe relay
+        struct Totals_t {
+            uint32_t onSeconds;
+            uint16_t cycles; // count of off to on
+        } __attribute__((packed));
+        struct RuntimePacket_t {
+            char tag[2]; // "RT"
+            uint8_t period;
+            uint8_t outputs; // as they are now
+            Totals_t totals[NUM_OUTPUTS]; // Z2 first
+        } __attribute__((packed));
+        static_assert(sizeof(RuntimePacket_t) <= RF69_MAX_DATA_LEN, "RuntimePacket_t must fit a radio packet");
+
+        uint8_t outputsOn;
+        msec_time_stamp_t onSince[NUM_OUTPUTS];
+        uint32_t thisHourMsec[NUM_OUTPUTS]; // off periods only. An output still on adds now - onSince
+        uint16_t thisHourCycles[NUM_OUTPUTS];
+        Totals_t rolled[NUMBER_OF_PERIODS - LAST_HOUR][NUM_OUTPUTS]; // THIS_HOUR is computed by thisHour()
+        uint8_t lastHour = 0xff;
+
+        Totals_t *rolledUp(uint8_t period) { return rolled[period - LAST_HOUR]; }
+
+        void outputsChanged(uint8_t outputs, msec_time_stamp_t now)
+        {
+            uint8_t changed = (outputs ^ outputsOn) >> BN_FIRST_SIGNAL;
+            outputsOn = outputs;
+            outputs >>= BN_FIRST_SIGNAL;
+            for (uint8_t i = 0; changed != 0; i++, changed >>= 1, outputs >>= 1)
+            {
+                if ((changed & 1) == 0)
+                    continue;
+                if (outputs & 1)
+                {
+                    onSince[i] = now;
+                    thisHourCycles[i] += 1;
+                }
+                else
+                    thisHourMsec[i] += now - onSince[i];
+            }
+        }
+
+        void thisHour(Totals_t *t, msec_time_stamp_t now)
+        {   // fills NUM_OUTPUTS Totals_t. Restarts the on period of the outputs that are on
+            uint8_t outputs = outputsOn >> BN_FIRST_SIGNAL;
+            for (uint8_t i = 0; i < NUM_OUTPUTS; i++, outputs >>= 1)
+            {
+                if (outputs & 1)
+                {
+                    thisHourMsec[i] += now - onSince[i];
+                    onSince[i] = now;
+                }
+                t[i].onSeconds = thisHourMsec[i] / 1000;
+                t[i].cycles = thisHourCycles[i];
+            }
+        }
+
+        void clock(uint8_t hour, msec_time_stamp_t now)
+        {   // called with the RTC hour every second or so
+            if (hour == lastHour)
+                return;
+            bool newDay = hour < lastHour && lastHour != 0xff;
+            lastHour = hour;
+            Totals_t *last = rolledUp(LAST_HOUR);
+            thisHour(last, now);
+            for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+            {
+                thisHourMsec[i] %= 1000; // carry the fraction into the new hour
+                thisHourCycles[i] = 0;
+                rolledUp(TODAY)[i].onSeconds += last[i].onSeconds;
+                rolledUp(TODAY)[i].cycles += last[i].cycles;
+            }
+            if (newDay)
+            {
+                memcpy(rolledUp(YESTERDAY), rolledUp(TODAY), sizeof(rolled[0]));
+                memset(rolledUp(TODAY), 0, sizeof(rolled[0]));
+            }
+        }
+
+        void send(uint8_t period, msec_time_stamp_t now)
+        {
+            RuntimePacket_t rp;
+            rp.tag[0] = 'R'; rp.tag[1] = 'T';
+            rp.period = period;
+            rp.outputs = outputsOn;
+            if (period == THIS_HOUR || period == TODAY)
+            {
+                thisHour(rp.totals, now);
+                if (period == TODAY)
+                    for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+                    {
+                        rp.totals[i].onSeconds += rolledUp(TODAY)[i].onSeconds;
+                        rp.totals[i].cycles += rolledUp(TODAY)[i].cycles;
+                    }
+            }
+            else
+                memcpy(rp.totals, rolledUp(period), sizeof(rp.totals));
+#if USE_SERIAL >= SERIAL_PORT_DEBUG
+            for (uint8_t i = 0; i < NUM_OUTPUTS; i++)
+            {
+                Serial.print(rp.totals[i].onSeconds); Serial.print(' ');
+                Serial.println(rp.totals[i].cycles);
+            }
+#endif
+            if (radioSetupOK)
+                RadioQueue::enqueue(RadioQueue::PACKET_RESPONSE, reinterpret_cast<const char *>(&rp), sizeof(rp));
+        }
+    }
+#endif
+
+#if EEPROM_IMAGE
+    namespace EepromImage {
+        /* Bulk access to the EEPROM this sketch and HVAC.cpp own, which starts at PACKET_THERMOSTAT_START.
+        ** RadioConfiguration's bytes below that are never read nor written, so one unit's image can be
+        ** copied to another. PacketThermostatSettings reads a unit's image with ER, and writes only the
+        ** blocks that differ with EW, whose CRC must match before any byte is written. ER alone also
+        ** lists the ranges that belong to the unit rather than to its configuration, which the
+        ** copy must leave alone. */
+        const uint16_t FIRST = static_cast<uint16_t>(EepromAddresses::PACKET_THERMOSTAT_START);
+        const uint16_t END = E2END + 1;
+        const uint8_t MAX_SERIAL_BLOCK = 32; // two hex digits each fits CMD_BUFLEN
+        struct EepromPacket_t {
+            char tag[2]; // "ER"
+            uint16_t addr;
+            uint8_t count;
+            uint8_t bytes[RF69_MAX_DATA_LEN - 5];
+        } __attribute__((packed));
+        static_assert(sizeof(EepromPacket_t) == RF69_MAX_DATA_LEN, "EepromPacket_t must fill a radio packet");
+        static_assert(sizeof(EepromPacket_t().bytes) >= MAX_SERIAL_BLOCK, "a block must fit a radio packet");
+
+        void printRange(int from, int to)
+        {
+#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
+            Serial.print(' ');
+            Serial.print(from, HEX);
+            Serial.print(' ');
+            Serial.print(to, HEX);
+#endif
+        }
+
+        void layout()
+        {   // ER alone. "ER <first> <end>", then a <from> <to> pair for each per-unit range
+            printRange(FIRST, END);
+            // the wire names, group id and learned recovery rates, and the recent setpoints
+            printRange(static_cast<int>(EepromAddresses::SIGNAL_LABEL_ASSIGNMENT),
+                static_cast<int>(EepromAddresses::DISPLAY_UNITS_ADDRESS));
+            printRange(static_cast<int>(EepromAddresses::GROUP_ID), static_cast<int>(EepromAddresses::LAYOUT_VERSION));
+            printRange(SETPOINT_RING_START, END);
+        }
+
+        uint16_t crcUpdate(uint16_t crc, uint8_t b)
+        {   // CRC-16/CCITT-FALSE: polynomial 0x1021, start 0xffff
+            crc ^= static_cast<uint16_t>(b) << 8;
+            for (uint8_t i = 0; i < 8; i++)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+            return crc;
+        }
+
+        void send(uint16_t addr, uint8_t count)
+        {   // ER <addr> <count>. Replies "ER <addr> :<hex>" on Serial, and EepromPacket_t to the radio
+            EepromPacket_t ep;
+            ep.tag[0] = 'E'; ep.tag[1] = 'R';
+            if (addr < FIRST)
+                addr = FIRST;
+            if (count > MAX_SERIAL_BLOCK)
+                count = MAX_SERIAL_BLOCK;
+            if (addr >= END)
+                count = 0;
+            else if (count > END - addr)
+                count = END - addr;
+            ep.addr = addr;
+            ep.count = count;
+            for (uint8_t i = 0; i < count; i++)
+                ep.bytes[i] = EEPROM.read(addr + i);
+#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
+            Serial.print(F("ER "));
+            Serial.print(addr, HEX);
+            Serial.print(F(" :"));
+            for (uint8_t i = 0; i < count; i++)
+            {
+                if (ep.bytes[i] < 0x10)
+                    Serial.print('0');
+                Serial.print(ep.bytes[i], HEX);
+            }
+            Serial.println();
+#endif
+            if (radioSetupOK)
+                RadioQueue::enqueue(RadioQueue::PACKET_RESPONSE, reinterpret_cast<const char *>(&ep),
+                    sizeof(ep) - sizeof(ep.bytes) + count);
+        }
+
+        bool write(uint16_t addr, uint16_t crc, const char *q)
+        {   // EW <addr> <crc> :<hex>. The CRC covers addr, low byte first, then the bytes
+            auto nibble = [](char c) -> uint8_t { return isdigit(c) ? c - '0' : 10 + toupper(c) - 'A'; };
+            if (*q++ != ':')
+                return false;
+            uint16_t check = crcUpdate(crcUpdate(0xffff, addr & 0xff), addr >> 8);
+            uint8_t count = 0;
+            for (const char *p = q; isxdigit(p[0]) && isxdigit(p[1]); p += 2, count++)
+                check = crcUpdate(check, (nibble(p[0]) << 4) | nibble(p[1]));
+            if (check != crc || count == 0 || addr < FIRST || addr + count > END)
+                return false;
+            PROFILE_SCOPE(EEPROM_PUT);
+            for (; count != 0; count--, q += 2)
+                EEPROM.update(addr++, (nibble(q[0]) << 4) | nibble(q[1]));
+            return true;
+        }
+
+        void restart()
+        {   // EW *. Everything in RAM that came from EEPROM is read again by setup()
+            wdt_enable(WDTO_15MS);
+            for (;;)
+                ;
+        }
+    }
 #endif
 
     char *reportHvac(char *p, uint8_t mask, char t)
@@ -519,8 +1300,8 @@ namespace
                 Serial.print(*q);
             Serial.println(F(")"));
 #endif
-            EEPROM.write(addr++,*p++);
-            EEPROM.write(addr++,*p++);
+            EEPROM.update(addr++,*p++);
+            EEPROM.update(addr++,*p++);
         }
     }
 
@@ -549,52 +1330,43 @@ namespace
         return static_cast<int16_t>((countsFromFreezeX64 * degreeCPerCountShift16) >> POWER2_FITS_IN_16); 
     }
 
-    // convert the C7089 ADC read value (64 of them summed) to degrees C times 10
+    // convert the C7089 ADC read value (times 64) to degrees C times 10
     int16_t degreesCx10FromC7089ADC(uint16_t ADCx64)
     {
-        uint16_t lowestADC = pgm_read_word_near(&C7089UCoefficients[0].ADCx64);
-        if (ADCx64 >= lowestADC)
-            return pgm_read_word_near(&C7089UCoefficients[0].TCelsiusX10);
-
-        uint16_t highestADC = pgm_read_word_near(&C7089UCoefficients[NUM_C7089_COEFFICIENTS-1].ADCx64);
-        if (ADCx64 <= highestADC)
-            return pgm_read_word_near(&C7089UCoefficients[NUM_C7089_COEFFICIENTS-1].TCelsiusX10);
-
-        uint8_t idx = NUM_C7089_COEFFICIENTS/2;
-        uint8_t minIdx = 0;
-        uint8_t maxIdx = NUM_C7089_COEFFICIENTS - 1;
-        // binary search
-        for (;;)
-        {
-            auto tbl = static_cast<uint16_t>(pgm_read_word_near(&C7089UCoefficients[idx].ADCx64));
-            if (ADCx64 == tbl)
-                return pgm_read_word_near(&C7089UCoefficients[idx].TCelsiusX10);
-            else if (ADCx64 > tbl)
-                maxIdx = idx;
-            else
-                minIdx = idx;
-
-            if (maxIdx - minIdx == 1)
-                break;
-
-            idx = (minIdx + maxIdx) >> 1;
-        }
-        // linear interpolate between the nearest two table entries.
-        // The "slope" is calculated by the compiler and appears in the table in PROGMEM.
-        // This compile-time calculation optimizes away a run time long integer divide operation.
-        uint16_t slope = static_cast<uint16_t>(pgm_read_word_near(&C7089UCoefficients[maxIdx].slope));
-        int16_t b = pgm_read_word_near(&C7089UCoefficients[minIdx].TCelsiusX10);
-        uint16_t dx = pgm_read_word_near(&C7089UCoefficients[minIdx].ADCx64) - ADCx64;
-
-        int32_t mx = slope;
-        mx *= dx;
-        mx >>= POWER2_C7089SlopeScale;
-        auto y = static_cast<int16_t>(b + mx);
-        return y;
+        if (ADCx64 < C7089U_MIN_ADCx64)
+            ADCx64 = C7089U_MIN_ADCx64;
+        else if (ADCx64 > C7089U_MAX_ADCx64)
+            ADCx64 = C7089U_MAX_ADCx64;
+        // linear interpolate between the two table entries. Temperature decreases as the ADC increases
+        uint8_t idx = ADCx64 >> POWER2_C7089U_TABLE_STEP;
+        uint16_t frac = ADCx64 & ((1u << POWER2_C7089U_TABLE_STEP) - 1);
+        int16_t t0 = pgm_read_word_near(&C7089UTable[idx]);
+        int16_t t1 = pgm_read_word_near(&C7089UTable[idx + 1]);
+        uint16_t dt = static_cast<uint16_t>(t0 - t1) * frac + (1u << (POWER2_C7089U_TABLE_STEP - 1)); // 16 bit multiply. See static_assert
+        return t0 - static_cast<int16_t>(dt >> POWER2_C7089U_TABLE_STEP);
     }
     
     void radioTemperatureReport(int16_t TinletCx10, int16_t tOutletCx10, int16_t tOutsideCx10)
     {
+        if (binaryTelemetry)
+        {
+            TemperatureTelemetry_t tt;
+            tt.tag = TELEMETRY_TEMPERATURE_TAG;
+            tt.inletCx10 = degreesCx10fromLM235ADCx64(TinletCx10);
+            tt.outletCx10 = degreesCx10fromLM235ADCx64(tOutletCx10);
+            tt.outsideCx10 = degreesCx10FromC7089ADC(tOutsideCx10);
+            int16_t t; int16_t a;
+            if (!hvac->GetTargetAndActual(t, a))
+                t = a = TELEMETRY_NO_TEMPERATURE;
+            tt.targetCx10 = t;
+            tt.actualCx10 = a;
+            tt.typeNumber = hvac->TypeNumber();
+            tt.modeNumber = hvac->ModeNumber();
+            tt.fanContinuous = ThermostatCommon::fanContinuous();
+            if (radioSetupOK)
+                RadioQueue::enqueue(RadioQueue::PACKET_TEMPERATURE, reinterpret_cast<const char *>(&tt), sizeof(tt));
+            return;
+        }
         char *p = &reportbuf[0];
         p = formatTemperature(p, degreesCx10fromLM235ADCx64(TinletCx10), 'i'); // 7 characters
         *p++ = ' ';                                                             // 8
@@ -623,7 +1395,7 @@ namespace
         *p++ = 0;
 
         if (radioSetupOK)
-            radio.sendWithRetry(GATEWAY_NODEID, reportbuf, strlen(reportbuf));
+            RadioQueue::enqueue(RadioQueue::PACKET_TEMPERATURE, reportbuf, strlen(reportbuf));
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
         Serial.print(radioSetupOK ? "Radio: " : "Not sent ");
         Serial.println(reportbuf);
@@ -639,15 +1411,31 @@ namespace
 
     void radioHvacReport(uint8_t in, uint8_t out)
     {
+        uint8_t outputs = out & OUTPUT_SIGNAL_MASK;
+        if (binaryTelemetry)
+        {
+            HvacTelemetry_t ht;
+            ht.tag = TELEMETRY_HVAC_TAG;
+            ht.inputs = in & INPUT_SIGNAL_MASK;
+            ht.outputs = outputs;
+            ht.typeNumber = hvac->TypeNumber();
+            ht.modeNumber = hvac->ModeNumber();
+            updateRtcTime();
+            ht.epochSeconds = rtc.getEpoch(true);
+            if (radioSetupOK)
+                RadioQueue::enqueue(RadioQueue::PACKET_HVAC, reinterpret_cast<const char *>(&ht), sizeof(ht));
+            lcdHvacReport(outputs);
+            return;
+        }
         auto p = reportHvacIn(reportbuf, in & INPUT_SIGNAL_MASK);
         *p++ = ' ';
-        uint8_t outputs = out & OUTPUT_SIGNAL_MASK;
         p = reportHvacOut(p,  outputs);
         *p++ = ' ';
+        updateRtcTime();
         auto q = rtc.stringTime8601();
         while (*p++ = *q++);
         if (radioSetupOK)
-            radio.sendWithRetry(GATEWAY_NODEID, reportbuf, strlen(reportbuf));
+            RadioQueue::enqueue(RadioQueue::PACKET_HVAC, reportbuf, strlen(reportbuf));
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
         Serial.print(radioSetupOK ? "Radio: " : "Not sent ");
         Serial.println(reportbuf);
@@ -655,16 +1443,19 @@ namespace
         lcdHvacReport(outputs);
     }
 
-    bool ProcessCommand(const char* cmd, unsigned char len)
+#if LOOP_PROFILE
+    void reportStats();
+#endif
+
+    bool ProcessCommand(CommandToken token, const char* args)
     {
-        static const char COMPRESSOR[] = "COMPRESSOR=0x";
         const char *q;
-        if (cmd[0] == 'T' && cmd[1] == '=')
+        if (token == CMD_TIME)
         {   // set the RTC time
             // T=YYYY MM DD HH MM SS DOW
             uint16_t year; uint8_t month; uint8_t dow;
             uint8_t day; uint8_t hour; uint8_t minute; uint8_t sec;
-            const char* p = cmd + 2;
+            const char* p = args;
             year = aDecimalToInt(p);
             month = aDecimalToInt(p);
             day = aDecimalToInt(p);
@@ -673,6 +1464,10 @@ namespace
             sec = aDecimalToInt(p);
             dow = aDecimalToInt(p);
             rtc.setTime(sec, minute, hour, dow, day, month, year);
+#if SCHEDULE_ENTRIES
+            ScheduleIndex::resync = true; // a clock change fires nothing it skipped over
+#endif
+            lcdClockResync = true;
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
             Serial.print(F("Setting clock to year:"));
             Serial.print(year);
@@ -683,7 +1478,7 @@ namespace
 #endif
             return true;
         } 
-        else if (toupper(cmd[0]) == 'I')
+        else if (token == CMD_INFO)
         {
             radioPrintInfo();
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -692,10 +1487,10 @@ namespace
 #endif
             return true;
         } 
-        else if (toupper(cmd[0]) == 'H' && toupper(cmd[1]) == 'V' && isspace(cmd[2]))
+        else if (token == CMD_HV)
         {   // set wire names in EEPROM
             // HV <R> <Z2> <Z1> <W> <ZX> <X2> <X1>
-            const char *p = cmd + 2;
+            const char *p = args;
             for (uint8_t i = 0; i < NUMBER_OF_SIGNALS; i++)
             {
                 char nameBuf[MAX_WIRE_NAME_LEN];
@@ -730,15 +1525,63 @@ namespace
             }            
             return true;
         } 
-        else if (toupper(cmd[0]) == 'D' && toupper(cmd[1]) == 'U' && cmd[2] == '=')
+        else if (token == CMD_DISPLAY_UNITS)
         {   // DU=F and DU=C  for farenheit and celsius. Only affects LCD
-            displayLcdFarenheit = cmd[3] == 'F';
-            EEPROM.write(static_cast<int>(EepromAddresses::DISPLAY_UNITS_ADDRESS), displayLcdFarenheit ? 1 : 0);
+            displayLcdFarenheit = *args == 'F';
+            EEPROM.update(static_cast<int>(EepromAddresses::DISPLAY_UNITS_ADDRESS), displayLcdFarenheit ? 1 : 0);
             return true;
         } 
-        else if (0 != (q = strstr(cmd, COMPRESSOR)))
-        {
-            q += sizeof(COMPRESSOR) - 1;
+        else if (token == CMD_TELEMETRY_FORMAT)
+        {   // TF=B and TF=A for binary and ASCII radio telemetry
+            binaryTelemetry = toupper(*args) == 'B';
+            EEPROM.update(static_cast<int>(EepromAddresses::TELEMETRY_FORMAT), binaryTelemetry ? 1 : 0);
+            return true;
+        } 
+        else if (token == CMD_GROUP_ID)
+        {   // GROUP=<node ID>. 0 leaves the unit only the broadcast address
+            q = args;
+            uint16_t id = aDecimalToInt(q);
+            if (id >= RF69_BROADCAST_ADDR || id == radioConfiguration.NodeId())
+                return false;
+            groupId = static_cast<uint8_t>(id);
+            EEPROM.update(static_cast<int>(EepromAddresses::GROUP_ID), groupId);
+            return true;
+        } 
+#if EEPROM_IMAGE
+        else if (token == CMD_EEPROM_READ)
+        {   // ER <addr> [<count>]. addr is hex
+            q = args;
+            while (isspace(*q)) q += 1;
+            if (!*q)
+            {   // ER alone says where the image starts and ends
+#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
+                Serial.print(F("ER"));
+                EepromImage::layout();
+                Serial.println();
+#endif
+                return true;
+            }
+            uint16_t addr = aHexToInt(q);
+            uint16_t count = *q ? aDecimalToInt(q) : EepromImage::MAX_SERIAL_BLOCK;
+            if (count > 0xff)
+                return false; // rather than wrap to a uint8_t
+            EepromImage::send(addr, static_cast<uint8_t>(count));
+            return true;
+        }
+        else if (token == CMD_EEPROM_WRITE)
+        {   // EW <addr> <crc> :<hex bytes>, or EW * to restart. addr and crc are hex
+            q = args;
+            while (isspace(*q)) q += 1;
+            if (*q == '*')
+                EepromImage::restart();
+            uint16_t addr = aHexToInt(q);
+            uint16_t crc = aHexToInt(q);
+            return EepromImage::write(addr, crc, q);
+        }
+#endif
+        else if (token == CMD_COMPRESSOR)
+        {   // COMPRESSOR=0x<mask> <seconds>
+            q = args;
             uint8_t mask = aHexToInt(q);
             if (!*q)
                 return false;
@@ -748,15 +1591,15 @@ namespace
             return true;
         } 
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
-        else if (0 == strcmp(cmd, "RH"))
+        else if (token == CMD_RH && !*args)
         {
             radioHvacReport(InputRegister, OutputRegister);
             return true;
         }
 #endif
-        else if (toupper(cmd[0]) == 'H' && toupper(cmd[1]) == 'S')
+        else if (token == CMD_HS)
         {
-            q = cmd + 2;
+            q = args;
             while (isspace(*q)) q += 1;
             auto c = *q++;
             if (c != 0) {
@@ -795,44 +1638,169 @@ namespace
                 }
             }
         }
+#if LOOP_PROFILE
+        else if (token == CMD_STATS && !*args)
+        {
+            reportStats();
+            return true;
+        }
+#endif
+#if RUNTIME_TOTALS
+        else if (token == CMD_RUNTIME)
+        {   // RUNTIME [period]
+            q = args;
+            while (isspace(*q)) q += 1;
+            uint8_t period = *q ? aDecimalToInt(q) : Runtime::TODAY;
+            if (period >= Runtime::NUMBER_OF_PERIODS) return false;
+            Runtime::send(period, millis());
+            return true;
+        }
+#endif
+#if EVENT_LOG
+        else if (token == CMD_LOG)
+        {   // LOG [sequence]
+            q = args;
+            while (isspace(*q)) q += 1;
+            EventLog::send(*q ? aDecimalToInt(q) : EventLog::nextSequence - EventLog::numEvents);
+            return true;
+        }
+#endif
 #if SCHEDULE_ENTRIES
-        else if (toupper(cmd[0]) == 'S' && toupper(cmd[1]) == 'E')
+        else if (token == CMD_SCHEDULE)
         {   // SE [which] [Celsiusx10] [HOUR] [MINUTE] [DAY-OF-WEEK-MASK]
-            q = cmd + 2;
+            q = args;
             while (isspace(*q)) q += 1;
+            ScheduleEntry_t se;
+            if (*q == '*')
+            {   // SE * clears them all
+                for (uint8_t i = 0; i < NUM_SCHEDULE_TEMPERATURE_ENTRIES; i++)
+                    setScheduleEntry(i, se);
+                ScheduleIndex::rebuild();
+                return true;
+            }
             uint8_t which = aDecimalToInt(q);
             if (which >= NUM_SCHEDULE_TEMPERATURE_ENTRIES) return false;
-            ScheduleEntry_t se;
             se.degreesCx5 = aDecimalToInt(q) >> 1; // x10 in command, saved as X5
             se.TimeOfDayHour = aDecimalToInt(q);
             se.TimeOfDayMinute = aDecimalToInt(q);
             se.DaysOfWeek = aHexToInt(q);
             se.AutoMode = *q == '1';
             setScheduleEntry(which, se);
+            ScheduleIndex::rebuild();
             return true;
         }
 #endif
-#if USE_SERIAL >= SERIAL_PORT_DEBUG
-        else if (strcmp(cmd, "CRASH") == 0)
-        {
-            ProcessCommand(cmd, len);
-        }
-        else if (toupper(cmd[0]) == 'U' && toupper(cmd[1]) == 'O' && cmd[2] == '=' && cmd[3] == '0' && cmd[4]=='x')
-        {
-            q = cmd+5;
-            uint8_t mask = aHexToInt(q);
-            Furnace::UpdateOutputs(mask);
-        }
-#endif
-        return false;
-    }
-
-    void setTemperatureCx10(int16_t t, bool autoMode = false);
-
-    void routeCommand(char* cmd, unsigned char len, uint8_t senderid = -1, bool toMe = true)
-    {
+#if OPTIMAL_START
+        else if (token == CMD_OPTIMAL_START)
+        {   // OS [<type> <minutes per degree C> [H]], or OS * to forget what was learned
+            q = args;
+            while (isspace(*q)) q += 1;
+            if (*q == '*')
+            {
+                for (uint8_t i = 0; i < NUM_OPTIMAL_START_TYPES; i++)
+                    OptimalStart::setRate(i, OptimalStart::UNKNOWN);
+                return true;
+            }
+            if (*q)
+            {
+                uint8_t type = aDecimalToInt(q);
+                if (type >= NUM_OPTIMAL_START_TYPES || !*q)
+                    return false;
+                while (isspace(*q)) q += 1;
+                uint16_t minutes = aDecimalToInt(q);
+                while (isspace(*q)) q += 1;
+                bool rising = toupper(*q) == 'H';
+                // the high bit is the direction, and MINUTES_MASK with RISING would be UNKNOWN
+                if (minutes > OptimalStart::MINUTES_MASK || (rising && minutes == OptimalStart::MINUTES_MASK))
+                    return false;
+                OptimalStart::setRate(type, static_cast<uint8_t>(minutes) | (rising ? OptimalStart::RISING : 0));
+                return true;
+            }
+#if USE_SERIAL >= SERIAL_PORT_SETUP
+            for (uint8_t i = 0; i < NUM_OPTIMAL_START_TYPES; i++)
+            {
+                uint8_t r = OptimalStart::rate(i);
+                Serial.print(F("OS ")); Serial.print((int)i); Serial.print(' ');
+                if (r == OptimalStart::UNKNOWN)
+                    Serial.println('?');
+                else
+                {
+                    Serial.print((int)(r & OptimalStart::MINUTES_MASK));
+                    Serial.println((r & OptimalStart::RISING) ? F(" H") : F(""));
+                }
+            }
+#endif
+            return true;
+        }
+#endif
+#if USE_SERIAL >= SERIAL_PORT_DEBUG
+        else if (token == CMD_CRASH && !*args)
+        {
+            ProcessCommand(token, args);
+        }
+        else if (token == CMD_UPDATE_OUTPUTS)
+        {
+            q = args;
+            uint8_t mask = aHexToInt(q);
+            Furnace::UpdateOutputs(mask);
+        }
+#endif
+        return false;
+    }
+
+    void setTemperatureCx10(int16_t t, bool autoMode = false);
+
+    namespace RxFilter {
+        /* spyMode hands us every packet on the network. The only ones not addressed to
+        ** this node that we act on are GRP commands to our group, and thermometer reports
+        ** from sensors in the current mode's SensorMask. The mask is cached here, refreshed whenever hvac takes a command,
+        ** so the rest are dropped before they are copied or parsed. */
+        uint32_t sensorMask;
+
+        void update()
+        {
+            sensorMask = hvac->SensorMask();
+        }
+
+        bool toGroup(uint8_t targetid)
+        {
+            return targetid == RF69_BROADCAST_ADDR || (groupId != 0 && targetid == groupId);
+        }
+
+        bool wanted(bool toMe, uint8_t senderid)
+        {
+            if (toMe)
+                return true;
+            return senderid < 32 && (sensorMask & (1uL << senderid)) != 0;
+        }
+    }
+
+    bool groupAllowed(const CommandView &cmd)
+    {   /* GRP reaches many units with one unACKed packet, so it runs only the mode, setpoint, clock and
+        ** schedule commands the whole fleet shares. Node IDs, keys, EEPROM, wiring and sensor choices stay
+        ** one unit at a time. COUNT= moves every mode's settings in EEPROM, so it is not allowed either. */
+        switch (cmd.token)
+        {
+        case CMD_HVAC:
+            return strstr(cmd.args, "COUNT=") == 0;
+        case CMD_HVAC_FAN:
+        case CMD_HVAC_SETTINGS:
+        case CMD_AUTO_SETTINGS:
+        case CMD_HUM_SETTINGS:
+        case CMD_PREDICT_SETTINGS:
+        case CMD_TIME:
+        case CMD_SCHEDULE:
+        case CMD_RH:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    void routeCommand(const CommandView &cmd, uint8_t senderid = -1, bool toMe = true)
+    {   // Packets to other nodes can only be thermometer reports. Their views are CMD_SENSOR
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
-        Serial.print(F("Command: ")); Serial.print(cmd); 
+        Serial.print(F("Command: ")); Serial.print(cmd.text); 
         if (senderid != static_cast<uint8_t>(-1))
         {
             Serial.print(F(" Sender: ")); Serial.println((int)senderid);
@@ -840,32 +1808,49 @@ namespace
         else
             Serial.println();
 #endif
-        if (toMe && radioConfiguration.ApplyCommand(cmd))
+        const auto token = cmd.token;
+        if (token == CMD_GROUP_COMMAND)
+        {   // GRP <sequence> <command>
+            const char *q = cmd.args;
+            uint16_t sequence = aDecimalToInt(q);
+            if (!*q || (haveGroupSequence && sequence == lastGroupSequence))
+                return; // nothing to do, or a repeat of the last one
+            lastGroupSequence = sequence;
+            haveGroupSequence = true;
+            while (isspace(*q))
+                q++;
+            auto inner = viewCommand(q, cmd.len - static_cast<uint8_t>(q - cmd.text));
+            if (groupAllowed(inner))
+                routeCommand(inner, senderid, false); // not toMe: RadioConfiguration never sees it
+            return;
+        }
+        if (toMe && radioConfiguration.ApplyCommand(cmd.text)) // its keywords are its own business
         {
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
             Serial.println(F("Command accepted for radio"));
 #endif
         }
-        else if (toMe && ProcessCommand(cmd, len))
+        else if (token != CMD_SENSOR && ProcessCommand(token, cmd.args))
         {
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
             Serial.println(F("Command accepted for main"));
 #endif
         }
-        else
+        else if (token != CMD_NONE)
         {
             int16_t targetCx10; int16_t actualCx10;
             bool tempOK = hvac->GetTargetAndActual( targetCx10, actualCx10);
             auto tempType = hvac->TypeNumber();
             auto tempMode = hvac->ModeNumber();
-            if (hvac->ProcessCommand(cmd, len, senderid, toMe))
+            if (hvac->ProcessCommand(cmd, senderid))
             {
 #if USE_SERIAL >= SERIAL_PORT_VERBOSE
                 Serial.println(F("Command accepted for HVAC"));
 #endif
                 LCD::printMode(hvac->ModeNameString());
+                RxFilter::update(); // the mode, or its SensorMask, may have changed
                 if (tempOK && hvac->TypeNumber() == tempType && hvac->ModeNumber() != tempMode)
-                    setTemperatureCx10(targetCx10);
+                    hvac->SetTargetCx10(targetCx10); // carry the target to the new MODE
                 InputsToHvacFlag = true;
             }
         }
@@ -897,7 +1882,7 @@ namespace
             strcpy(buf, AUTO_SETTINGS);
 #endif
         itoa(t, buf + strlen(buf), 10);
-        routeCommand(buf, strlen(buf));
+        routeCommand(viewCommand(buf, strlen(buf)));
     }
 }
 
@@ -910,6 +1895,9 @@ namespace Furnace {
     msec_time_stamp_t relayonAtTime;
     const unsigned long MINIMUM_W_ON_MSEC = 60000L;
 
+    void compressorHoldExpired(msec_time_stamp_t);
+    void wRelayMinimumExpired(msec_time_stamp_t);
+
     void UpdateOutputs(uint8_t mask)
     {
         mask &= OUTPUT_SIGNAL_MASK;
@@ -929,6 +1917,7 @@ namespace Furnace {
             {   // this command is turning the compressor off
                 CompressorOffTimeActive = true;
                 CompressorOffStartTime = now;
+                Deadlines::arm(Deadlines::COMPRESSOR_HOLD, now + 1000L * CompressorHoldSeconds, compressorHoldExpired);
             }
         }
         if (CompressorOffTimeActive)
@@ -942,12 +1931,21 @@ namespace Furnace {
         /* Deal with possibility that W signal is coming from furnace side. 
         ** Once W relay is pulled in, keep it in for a while to prevent chatter */
         
-        if ((wRelayIsOn && (wRelayIsOn = (now - relayonAtTime < MINIMUM_W_ON_MSEC))) ||
-            ((((mask & (1 << BN_W)) ^ (InputRegister & (1 << BN_W))) != 0) && 
-                (relayonAtTime = now, wRelayIsOn = true) //assignments
-            )) 
+        if (wRelayIsOn)
+            wRelayIsOn = now - relayonAtTime < MINIMUM_W_ON_MSEC;
+        if (!wRelayIsOn && ((mask ^ InputRegister) & (1 << BN_W)) != 0)
+        {
+            wRelayIsOn = true;
+            relayonAtTime = now;
+            Deadlines::arm(Deadlines::W_RELAY_MINIMUM_ON, now + MINIMUM_W_ON_MSEC, wRelayMinimumExpired);
+        }
+        if (wRelayIsOn)
             mask |= 1 << BN_W_FAILSAFE; /// hardware relay on
 
+#if RUNTIME_TOTALS
+        if (mask != OutputRegister)
+            Runtime::outputsChanged(mask, now);
+#endif
         OutputRegister = mask;
 #if ENABLE_OUTPUT_RELAYS > 0
 #if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
@@ -976,53 +1974,758 @@ namespace Furnace {
         UpdateOutputs(next);
     }
 
-    void loop(msec_time_stamp_t now)
+    void compressorHoldExpired(msec_time_stamp_t)
+    {   // the compressor short cycle prevention is over
+        CompressorOffTimeActive = false;
+        SetOutputBits();
+    }
+
+    void wRelayMinimumExpired(msec_time_stamp_t)
+    {   // UpdateOutputs decides whether the relay can drop out now
+        SetOutputBits();
+    }
+}
+
+namespace InputCapture {
+    /* The thermostat inputs are 24VAC, so the PCB input pins pulse LOW at 60Hz while a signal is on.
+    ** Only 3 of the 7 input pins have an external or pin-change interrupt on the 32U4, so instead
+    ** of edge interrupts, Timer3 interrupts at INPUT_SAMPLE_HZ and its ISR samples all of the
+    ** input pins. The ISR does the debounce: a signal is ON at its first LOW sample, and OFF after 
+    ** INPUT_AC_ACTIVE_MIN_MSEC of no LOW samples. Each change in the debounced inputs is timestamped
+    ** into a small ring buffer that loop() drains. No transition is missed no matter how long
+    ** loop() is held up in, for example, an I2C transaction. */
+    const uint8_t QUIET_SAMPLES_FOR_OFF = static_cast<uint8_t>(static_cast<uint32_t>(INPUT_AC_ACTIVE_MIN_MSEC) * INPUT_SAMPLE_HZ / 1000);
+    static_assert(static_cast<uint32_t>(INPUT_AC_ACTIVE_MIN_MSEC) * INPUT_SAMPLE_HZ / 1000 < 255, "quiet sample count must fit in uint8_t");
+
+    // the PCB input pin for each of the OutregBits, starting at bit 0. (X3 has no input)
+    const uint8_t NUM_INPUT_PINS = BN_X1 + 1;
+    const uint8_t InputPins[NUM_INPUT_PINS] = { PCB_INPUT_R_ACTIVE_PIN, PCB_INPUT_Z2_PIN, PCB_INPUT_Z1_PIN, 
+        PCB_INPUT_W_PIN, PCB_INPUT_ZX_PIN, PCB_INPUT_X2_PIN, PCB_INPUT_X1_PIN };
+
+    volatile uint8_t *pinRegister[NUM_INPUT_PINS];
+    uint8_t pinBitMask[NUM_INPUT_PINS];
+    uint8_t quietSamples[NUM_INPUT_PINS]; // ISR only. number of samples since last seen LOW
+    uint8_t debouncedInputs;              // ISR only
+
+    struct Transition {
+        msec_time_stamp_t when;
+        uint8_t inputs;
+    };
+    const uint8_t NUM_TRANSITIONS = 8; // must be a power of 2
+    Transition transitions[NUM_TRANSITIONS];
+    volatile uint8_t transitionHead; // written only by the ISR
+    uint8_t transitionTail;          // written only by loop()
+
+    void setup()
+    {   // call after the pinMode() settings for the inputs
+        for (uint8_t i = 0; i < NUM_INPUT_PINS; i++)
+        {
+            pinRegister[i] = portInputRegister(digitalPinToPort(InputPins[i]));
+            pinBitMask[i] = digitalPinToBitMask(InputPins[i]);
+            quietSamples[i] = QUIET_SAMPLES_FOR_OFF;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            TCCR3A = 0;
+            TCCR3B = _BV(WGM32) | _BV(CS31); // CTC mode, clk/8
+            OCR3A = (F_CPU / 8 / INPUT_SAMPLE_HZ) - 1;
+            TCNT3 = 0;
+            TIMSK3 = _BV(OCIE3A);
+        }
+    }
+
+    inline void sample()
     {
-        if (wRelayIsOn && (now - relayonAtTime >= MINIMUM_W_ON_MSEC))
-            SetOutputBits();
+        uint8_t next = debouncedInputs;
+        uint8_t mask = 1;
+        for (uint8_t i = 0; i < NUM_INPUT_PINS; i++, mask <<= 1)
+        {
+            if ((*pinRegister[i] & pinBitMask[i]) == 0)
+            {   // LOW means 24VAC is present on this half cycle
+                quietSamples[i] = 0;
+                next |= mask;
+            }
+            else if (quietSamples[i] < QUIET_SAMPLES_FOR_OFF)
+            {
+                if (++quietSamples[i] >= QUIET_SAMPLES_FOR_OFF)
+                    next &= ~mask;
+            }
+        }
+        if (next == debouncedInputs)
+            return;
+        debouncedInputs = next;
+        uint8_t head = transitionHead;
+        uint8_t nextHead = (head + 1) & (NUM_TRANSITIONS - 1);
+        if (nextHead == transitionTail)
+        {   // full. Merge into the newest entry so the latest state is never lost
+            head = (head - 1) & (NUM_TRANSITIONS - 1);
+            nextHead = transitionHead;
+        }
+        transitions[head].when = millis();
+        transitions[head].inputs = next;
+        transitionHead = nextHead;
+    }
+
+    bool nextTransition(uint8_t &inputs, msec_time_stamp_t &when)
+    {   // returns true, and the debounced inputs and their millis(), for the oldest not-yet-seen transition
+        bool ret = false;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            uint8_t tail = transitionTail;
+            if (tail != transitionHead)
+            {
+                inputs = transitions[tail].inputs;
+                when = transitions[tail].when;
+                transitionTail = (tail + 1) & (NUM_TRANSITIONS - 1);
+                ret = true;
+            }
+        }
+        return ret;
     }
 }
 
-uint16_t aDecimalToInt(const char*& p)
-{   // p is set to character following terminating non-digit, unless null
-    uint16_t ret = 0;
-    for (;;)
+namespace AdcEngine {
+    /* The temperature channels are converted in the background. Each Timer3 tick starts one
+    ** conversion, and the ADC conversion-complete interrupt adds the result to its channel's
+    ** sum and moves the multiplexer to the next channel. Round-robin over 3 channels at
+    ** INPUT_SAMPLE_HZ samples each channel at 320Hz, which steps 3/16 of a 60Hz cycle per sample,
+    ** so any 16 consecutive samples of a channel land on all 16 phases of the mains. A block
+    ** of 2**POWER2_ADC_OVERSAMPLE samples per channel is a whole number of 60Hz cycles, and the
+    ** hum picked up on long thermostat wire runs averages out of it.
+    ** Each block is decimated to the x64 scale the temperature conversions take. */
+    const uint8_t NUM_CHANNELS = 3;
+    const uint8_t AnalogPins[NUM_CHANNELS] = { T_LM235_INLET_PIN, T_LM235_OUTLET_PIN, S1_7089U_OUTSIDE_PIN };
+    const int POWER2_ADC_OVERSAMPLE = 8; // 256 samples per channel, every 0.8 seconds
+    static_assert(POWER2_ADC_OVERSAMPLE >= POWER2_ADC_READS_TO_AVERAGE, "decimation cannot scale up");
+    static_assert((1 << POWER2_ADC_OVERSAMPLE) % 16 == 0, "a block must be whole 60Hz cycles");
+    static_assert(INPUT_SAMPLE_HZ == 960, "the phase spreading above assumes 16 ticks per 60Hz cycle");
+
+    uint8_t admux[NUM_CHANNELS];   // ADMUX for each channel, reference bits included
+    uint8_t adcsrb[NUM_CHANNELS];  // MUX5 bit for each channel
+    uint32_t sums[NUM_CHANNELS];   // ISR only
+    uint16_t samples;              // ISR only. samples into the current block, all channels
+    uint8_t channel;               // ISR only. channel the ADC multiplexer is on
+    uint16_t completedx64[NUM_CHANNELS]; // the latest block, written only by the ISR
+    volatile bool haveCompleted;
+
+    void selectChannel(uint8_t c)
+    {
+        ADCSRB = (ADCSRB & ~_BV(MUX5)) | adcsrb[c];
+        ADMUX = admux[c];
+    }
+
+    void setup()
+    {   // call after analogReference(). Timer3 (see InputCapture) starts the conversions
+        for (uint8_t i = 0; i < NUM_CHANNELS; i++)
+        {   // same channel mapping analogRead() does on the 32U4
+            uint8_t pin = AnalogPins[i];
+            if (pin >= A0)
+                pin -= A0;
+            pin = analogPinToChannel(pin);
+            admux[i] = _BV(REFS0) | (pin & 0x07); // REFS0 is DEFAULT: AVcc
+            adcsrb[i] = (pin & 0x08) ? _BV(MUX5) : 0;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            channel = 0;
+            samples = 0;
+            memset(sums, 0, sizeof(sums));
+            selectChannel(0);
+            ADCSRA |= _BV(ADIE); // prescaler stays as the Arduino core set it: 125KHz, about 104usec per conversion
+        }
+    }
+
+    inline void start()
+    {   // from the Timer3 ISR. The previous conversion finished long ago: the tick is 1.04msec
+        if (!(ADCSRA & _BV(ADSC)))
+            ADCSRA |= _BV(ADSC);
+    }
+
+    inline void converted()
     {
-        auto c = *p;
-        if (c >= '0' && c <= '9')
+        sums[channel] += ADC;
+        if (++channel >= NUM_CHANNELS)
+            channel = 0;
+        selectChannel(channel);
+        if (++samples < (NUM_CHANNELS << POWER2_ADC_OVERSAMPLE))
+            return;
+        for (uint8_t i = 0; i < NUM_CHANNELS; i++)
         {
-            ret *= 10;
-            ret += c - '0';
-            p+=1;
-        } else 
+            completedx64[i] = static_cast<uint16_t>(sums[i] >> (POWER2_ADC_OVERSAMPLE - POWER2_ADC_READS_TO_AVERAGE));
+            sums[i] = 0;
+        }
+        samples = 0;
+        haveCompleted = true;
+    }
+
+    bool latest(uint16_t x64[NUM_CHANNELS])
+    {   // false until the first block is complete
+        bool ret = false;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
         {
-            if (c != 0)
-                p+=1;
-            return ret;
+            if (haveCompleted)
+            {
+                memcpy(x64, completedx64, sizeof(completedx64));
+                ret = true;
+            }
         }
+        return ret;
     }
 }
 
-uint32_t aHexToInt(const char*&p)
-{   // p is set to character following terminating non-digit, unless null
-    uint32_t ret = 0;
-    for (;;)
+ISR(TIMER3_COMPA_vect)
+{
+    InputCapture::sample();
+    AdcEngine::start();
+}
+
+ISR(ADC_vect)
+{
+    AdcEngine::converted();
+}
+
+namespace {
+    // The subsystems that loop() runs. See Scheduler below
+
+    void taskInputs(msec_time_stamp_t)
+    {   // The 60Hz AC to input signal conversion is done by InputCapture in its interrupt routine.
+        // Every transition it queued while loop() was busy elsewhere is handed to hvac in order.
+        for (;;)
+        {
+            auto previousInputRegister = InputRegister;
+            msec_time_stamp_t when;
+            bool transition = InputCapture::nextTransition(InputRegister, when);
+            if (!transition && !InputsToHvacFlag)
+                break;
+            InputsToHvacFlag = false;
+            hvac->OnInputsChanged(InputRegister, previousInputRegister); // hvac can CHANGE inputregister
+            Furnace::SetOutputBits();
+        }
+        LCD::backLight(0 != (InputRegister & (1 << BN_R)));
+    }
+
+    void taskDeadlines(msec_time_stamp_t now)
+    {   // the hold timers and the rest of the Deadlines list
+        Deadlines::loop(now);
+    }
+
+    void heatSafetyHoldExpired(msec_time_stamp_t)
+    {
+        HeatSafetyOffTimeActive = false;
+        LCD::printBanner(hvac->ModeNameString());
+        Furnace::SetOutputBits();
+    }
+
+    void taskHeatSafety(msec_time_stamp_t now)
+    {   // check inlet temperature in heat modes and shut down if EEPROM settings say so
+        if (HeatSafetyOffTimeActive)
+            return;
+        auto heatSafetySeconds = HeatSafetyHoldSeconds;
+        if (heatSafetySeconds > 0 && heatSafetySeconds != static_cast<uint16_t>(0xffff))
+        {
+            auto heatSafetyTempCx10 = getHeatSafetyTemperatureCx10();
+            if (heatSafetyTempCx10 > 0)
+            {
+                if (heatSafetyTempCx10 <= TinletTemperatureCx10)
+                {   // safety triggerred
+                    for (uint8_t i = 0; i < NUM_HEAT_SAFETY_ENTRIES; i++)
+                    {
+                        HeatSafetyMask_t m = getHeatSafetyMask(i);
+                        uint8_t bits = ~m.dontCareMask & Furnace::LastOutputWrite;
+                        if (bits == m.mustMatchMask && m.toClear != 0)
+                        { // table indicates this IS a heat mode, so shut down heat
+                            HeatSafetyOffStartTime = now;
+                            HeatSafetyOffTimeActive = true;
+                            Deadlines::arm(Deadlines::HEAT_SAFETY_HOLD, now + 1000L * heatSafetySeconds, heatSafetyHoldExpired);
+                            LCD::printBanner(HeatSafetyBanner);
+                            HeatSafetyShutoffMask = ~m.toClear;
+                            Furnace::SetOutputBits();
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void taskHvac(msec_time_stamp_t now)
+    {
+        hvac->loop(now);
+        ThermostatCommon::loopCommit(now);
+    }
+
+    void taskRadioReceive(msec_time_stamp_t)
+    {
+        if (radio.receiveDone() && !RadioQueue::isAckForMe()) // Got a packet over the radio
+        {
+            bool toMe = radioConfiguration.NodeId() == radio.TARGETID;
+            bool toGroup = !toMe && RxFilter::toGroup(static_cast<uint8_t>(radio.TARGETID));
+            if (!RxFilter::wanted(toMe || toGroup, static_cast<uint8_t>(radio.SENDERID)))
+                return; // someone else's traffic
+            /* The copy is needed: sendACK can receive the next packet into radio.DATA. Copy only
+            ** what was received, and null terminate it here rather than count on the RFM69 to. */
+            const uint8_t len = radio.DATALEN < RF69_MAX_DATA_LEN ? radio.DATALEN : RF69_MAX_DATA_LEN;
+            memcpy(reportbuf, &radio.DATA[0], len);
+            reportbuf[len] = 0;
+            auto cmd = viewCommand(reportbuf, len, toMe || toGroup);
+            if (toGroup)
+            {
+                if (cmd.token != CMD_GROUP_COMMAND)
+                    cmd = viewCommand(reportbuf, len, false); // a thermometer report to a group address
+                else
+                    toMe = true; // but no ACK: every unit in the group would send one at once. See groupAllowed
+            }
+            if (toMe && !toGroup && radio.ACKRequested())
+            {
+                PROFILE_SCOPE(RADIO_SEND);
+                radio.sendACK();
+            }
+            routeCommand(cmd, static_cast<uint8_t>(radio.SENDERID), toMe);
+#if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
+            Serial.print(F("FromRadio: \""));
+            Serial.print(reportbuf);
+            Serial.print(F("\" sender:"));
+            Serial.print(radio.SENDERID);
+            Serial.print(" target:");
+            Serial.println(radio.TARGETID);
+#endif
+        }
+    }
+
+    void taskSerial(msec_time_stamp_t)
+    {   // check for Serial input
+#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
+        while (Serial.available())
+        {
+            auto c = Serial.read();
+            if (c < 0)
+                break;
+            auto ch = static_cast<char>(c);
+            bool isRet = ch == '\n' || ch == '\r';
+            if (!isRet)
+                cmdbuf[charsInBuf++] = ch;
+            cmdbuf[charsInBuf] = 0;
+            if (isRet || charsInBuf >= CMD_BUFLEN - 1)
+            {
+                routeCommand(viewCommand(cmdbuf, charsInBuf));
+                Serial.println(F("ready>"));
+                charsInBuf = 0;
+            }
+        }
+#endif
+    }
+
+    void taskRadioSend(msec_time_stamp_t now)
+    {
+        if (radioSetupOK)
+            RadioQueue::loop(now);
+    }
+
+    void taskHvacReport(msec_time_stamp_t)
+    {   // report changes in inputs or outputs, and log those and the other state changes
+        static uint8_t reportedInputs;
+        static uint8_t reportedOutputs;
+        if (((reportedInputs & INPUT_SIGNAL_MASK) != (InputRegister & INPUT_SIGNAL_MASK)) 
+            || (reportedOutputs != OutputRegister))
+        {
+            reportedInputs = InputRegister;
+            reportedOutputs = OutputRegister;
+#if EVENT_LOG
+            EventLog::add(InputRegister & INPUT_SIGNAL_MASK, OutputRegister);
+#endif
+            radioHvacReport(InputRegister, OutputRegister);
+        }
+#if EVENT_LOG
+        static uint8_t loggedType = 0xff;
+        static uint8_t loggedMode;
+        static bool loggedCompressorHold;
+        static bool loggedHeatSafety;
+        if (hvac->TypeNumber() != loggedType || hvac->ModeNumber() != loggedMode)
+        {
+            loggedType = hvac->TypeNumber();
+            loggedMode = hvac->ModeNumber();
+            EventLog::add(EventLog::EVENT_MODE | (loggedType & 0xf), loggedMode);
+        }
+        if (CompressorOffTimeActive != loggedCompressorHold)
+        {
+            loggedCompressorHold = CompressorOffTimeActive;
+            EventLog::add(EventLog::EVENT_COMPRESSOR_HOLD, loggedCompressorHold ? 1 : 0);
+        }
+        if (HeatSafetyOffTimeActive != loggedHeatSafety)
+        {
+            loggedHeatSafety = HeatSafetyOffTimeActive;
+            EventLog::add(EventLog::EVENT_HEAT_SAFETY, loggedHeatSafety ? 1 : 0);
+        }
+#endif
+    }
+
+    uint16_t filterADC(uint16_t avgx64, uint16_t x64, bool first)
+    {
+        if (first)
+            return x64;
+        return avgx64 + static_cast<int16_t>((static_cast<int32_t>(x64) - avgx64) >> POWER2_ADC_FILTER);
+    }
+
+    void taskTemperatures(msec_time_stamp_t now)
+    {   // runs every POLL_ADC_MSEC. Filter the reads, report when changed or on BETWEEN_REPORTING_TEMPERTURE_MSEC
+        static bool haveReads;
+        static msec_time_stamp_t lastReportTime;
+        static int16_t reportedCx10[3];
+        uint16_t x64[AdcEngine::NUM_CHANNELS];
+        {
+            PROFILE_SCOPE(ANALOG_READ);
+            if (!AdcEngine::latest(x64)) // the conversions are in the ADC interrupt
+                return;
+        }
+        TinletADCx64 = filterADC(TinletADCx64, x64[0], !haveReads); // Pro Micro has 10bit A/D
+        ToutletADCx64 = filterADC(ToutletADCx64, x64[1], !haveReads);
+        TexternalADCx64 = filterADC(TexternalADCx64, x64[2], !haveReads);
+        TinletTemperatureCx10 = degreesCx10fromLM235ADCx64(TinletADCx64);
+        const int16_t nowCx10[3] = {
+            TinletTemperatureCx10,
+            degreesCx10fromLM235ADCx64(ToutletADCx64),
+            degreesCx10FromC7089ADC(TexternalADCx64) };
+
+        const auto sinceReport = now - lastReportTime;
+        bool changed = false;
+        for (uint8_t i = 0; i < 3; i++)
+            if (abs(nowCx10[i] - reportedCx10[i]) >= REPORT_TEMPERATURE_CHANGE_Cx10)
+                changed = true;
+        if (haveReads &&  // the first read seeds the filters and is reported right away
+            sinceReport < BETWEEN_REPORTING_TEMPERTURE_MSEC &&
+            (!changed || sinceReport < MIN_BETWEEN_REPORTING_TEMPERATURE_MSEC))
+            return;
+        haveReads = true;
+        radioTemperatureReport(TinletADCx64, ToutletADCx64, TexternalADCx64);
+        lastReportTime = now;
+        memcpy(reportedCx10, nowCx10, sizeof(reportedCx10));
+    }
+
+#if SCHEDULE_ENTRIES
+    void fireScheduleEntry(const ScheduleEntry_t &se)
     {
-        auto c = *p;
-        if (isxdigit(c))
+        int16_t targetCx10 = static_cast<int16_t>(se.degreesCx5) << 1;
+        setTemperatureCx10(targetCx10, se.AutoMode);
+        LCD::reinit = true;
+#if OPTIMAL_START
+        if (!se.AutoMode)
+            OptimalStart::started(targetCx10);
+#endif
+    }
+
+    void taskSchedule(msec_time_stamp_t now)
+    {   // cheap until wakeAt. See ScheduleIndex
+        using namespace ScheduleIndex;
+#if OPTIMAL_START
+        OptimalStart::watch(now);
+#endif
+        if (!resync && static_cast<int32_t>(now - wakeAt) < 0)
+            return;
+        updateRtcTime();
+        uint16_t minuteOfWeek = rtc.getWeekday() * MINUTES_PER_DAY + rtc.getHours() * 60 + rtc.getMinutes();
+        if (resync)
+        {
+            resync = false;
+#if OPTIMAL_START
+            OptimalStart::earlyMinute = OptimalStart::NO_MINUTE;
+#endif
+        }
+        else
+        {
+            uint16_t elapsed = (minuteOfWeek + MINUTES_PER_WEEK - checkedThrough) % MINUTES_PER_WEEK;
+            for (;;)
+            {
+                uint16_t next = minutesUntilNext(checkedThrough);
+                if (next == 0 || next > elapsed)
+                    break;
+                elapsed -= next;
+                checkedThrough = (checkedThrough + next) % MINUTES_PER_WEEK;
+                uint8_t dayMask = 1 << (checkedThrough / MINUTES_PER_DAY);
+                uint16_t minute = checkedThrough % MINUTES_PER_DAY;
+#if OPTIMAL_START
+                if (checkedThrough == OptimalStart::earlyMinute)
+                {   // already fired
+                    OptimalStart::earlyMinute = OptimalStart::NO_MINUTE;
+                    continue;
+                }
+#endif
+                for (uint8_t i = 0; i < count; i++)
+                    if (minuteOfDay(sorted[i]) == minute &&
+                        (static_cast<uint8_t>(sorted[i].DaysOfWeek) & dayMask))
+                        fireScheduleEntry(sorted[i]);
+            }
+        }
+        checkedThrough = minuteOfWeek;
+        uint16_t sleepMinutes = minutesUntilNext(minuteOfWeek);
+#if OPTIMAL_START
+        uint16_t due = (minuteOfWeek + sleepMinutes) % MINUTES_PER_WEEK;
+        if (sleepMinutes != 0 && due != OptimalStart::earlyMinute)
         {
-            ret *= 16;
-            if (isdigit(c))
-                ret += c - '0';
+            uint16_t lead = OptimalStart::leadMinutes(due);
+            if (lead >= sleepMinutes)
+            {   // time to start
+                uint8_t dayMask = 1 << (due / MINUTES_PER_DAY);
+                uint16_t minute = due % MINUTES_PER_DAY;
+                for (uint8_t i = 0; i < count; i++)
+                    if (minuteOfDay(sorted[i]) == minute &&
+                        (static_cast<uint8_t>(sorted[i].DaysOfWeek) & dayMask))
+                        fireScheduleEntry(sorted[i]);
+                OptimalStart::earlyMinute = due;
+            }
             else
-                ret += 10 + toupper(c) - 'A';
-            p+=1;
-        } else
+                sleepMinutes -= lead; // wake when it is
+        }
+#endif
+        if (sleepMinutes == 0 || sleepMinutes > MAX_SLEEP_MINUTES)
+            sleepMinutes = MAX_SLEEP_MINUTES;
+        // wake at the start of the due minute
+        wakeAt = now + sleepMinutes * 60000UL - rtc.getSeconds() * 1000UL;
+    }
+#endif
+
+    void taskLcdClock(msec_time_stamp_t now)
+    {   // every second (or so) update the RTC time on the LCD
+        static bool firstTime = true;
+        static msec_time_stamp_t rolloverAt; // when millis() says the RTC's minute changes
+        if (firstTime)
         {
-            if (c!= 0)
-                p+=1;
-            return ret;
+            firstTime = false;
+            return;
         }
+        if (lcdClockResync || static_cast<int32_t>(now - rolloverAt) >= 0)
+        {   // the RTC is read over I2C only once a minute. In between its cached hour and minute are current
+            updateRtcTime();
+            rolloverAt = now + (60 - rtc.getSeconds()) * 1000UL;
+            lcdClockResync = false;
+        }
+        uint8_t hrs = rtc.getHours();
+        uint8_t min = rtc.getMinutes();
+#if RUNTIME_TOTALS
+        Runtime::clock(hrs, now);
+#endif
+        char *p = reportbuf;
+        if (hrs < 10)
+            *p++ = '0';
+        else
+        {
+            *p++ = '0' + hrs / 10;
+            hrs %= 10;
+        }
+        *p++ = '0' + hrs;
+        *p++ = ':';
+        if (min < 10)
+            *p++ = '0';
+        else
+        {
+            *p++ = '0' + min / 10;
+            min %= 10;
+        }
+        *p++ = '0' + min;
+        *p++ = 0;
+        LCD::printTime(&reportbuf[0]);
+        printHvacTemperatures();
+        LCD::printCompressorHold(CompressorOffTimeActive ? "H" : "");
+    }
+
+    void taskLcd(msec_time_stamp_t now)
+    {
+        if (LCD::reinit)
+        {
+            LCD::printBanner(HeatSafetyOffTimeActive ? HeatSafetyBanner : hvac->ModeNameString());
+            lcdHvacReport(OutputRegister & OUTPUT_SIGNAL_MASK);
+            LCD::reinit = false;
+        }
+        LCD::loop(now);
+    }
+}
+
+#if LOOP_PROFILE
+namespace Profile {
+    /* The STATS command sends Stats_t in a radio packet, then clears it. */
+    const uint8_t NUMBER_OF_LOOP_BUCKETS = 10; // bucket 0 is under 1 msec, bucket n is under 2**n msec. The last is all longer
+    struct CallStats_t {
+        uint16_t count;
+        uint32_t maxMicros;
+    } __attribute__((packed));
+    struct Stats_t {
+        char tag[2]; // "ST"
+        uint16_t loopMaxMsec;
+        uint16_t loopHistogram[NUMBER_OF_LOOP_BUCKETS]; // count of loop() passes
+        CallStats_t calls[NUMBER_OF_BLOCKING_CALLS];
+        uint8_t worstTask; // index into Scheduler::Tasks
+        uint32_t worstTaskMicros;
+    } __attribute__((packed));
+    static_assert(sizeof(Stats_t) <= RF69_MAX_DATA_LEN, "Stats_t must fit a radio packet");
+    Stats_t stats;
+
+    void add(BlockingCall w, unsigned long microsTaken)
+    {
+        if (stats.calls[w].count != 0xffffu)
+            stats.calls[w].count += 1;
+        if (microsTaken > stats.calls[w].maxMicros)
+            stats.calls[w].maxMicros = microsTaken;
+    }
+
+    void loopPass(unsigned long microsTaken)
+    {
+        unsigned long msec = microsTaken / 1000;
+        if (msec > stats.loopMaxMsec)
+            stats.loopMaxMsec = msec > 0xffffu ? 0xffffu : msec;
+        uint8_t bucket = 0;
+        while (msec != 0 && bucket < NUMBER_OF_LOOP_BUCKETS - 1)
+        {
+            msec >>= 1;
+            bucket += 1;
+        }
+        if (stats.loopHistogram[bucket] != 0xffffu)
+            stats.loopHistogram[bucket] += 1;
+    }
+}
+#define PROFILE_LOOP_PASS(microsTaken) Profile::loopPass(microsTaken)
+#else
+#define PROFILE_LOOP_PASS(microsTaken)
+#endif
+
+namespace Scheduler {
+    /* loop() is a table-driven cooperative scheduler. Each subsystem is a Task with a period.
+    ** The table is in priority order. Every pass of loop() runs each of the first NUMBER_OF_CRITICAL_TASKS,
+    ** then at most one of the remaining tasks that is due, taking turns among them. So the worst case 
+    ** latency from a thermostat call to the furnace output is the sum of the worst case run times of 
+    ** the critical tasks plus the worst of the others. Those run times are measured here. */
+    typedef void (*TaskFunction)(msec_time_stamp_t now);
+    struct Task {
+        TaskFunction run;
+        uint16_t periodMsec; // zero means every pass
+    };
+
+    const Task Tasks[] PROGMEM = {
+        // critical tasks
+        {taskInputs, 0},
+        {taskDeadlines, 0},
+        {taskHeatSafety, 0},
+        {taskHvac, 0},
+        {taskRadioReceive, 0},
+        // the remaining tasks take turns
+        {taskSerial, 0},
+        {taskRadioSend, 0},
+        {taskHvacReport, 0},
+        {taskTemperatures, POLL_ADC_MSEC},
+#if SCHEDULE_ENTRIES
+        {taskSchedule, 1000},  // sleeps until ScheduleIndex::wakeAt
+#endif
+        {taskLcdClock, 1000},
+        {taskLcd, 0},
+    };
+    const uint8_t NUMBER_OF_TASKS = sizeof(Tasks) / sizeof(Tasks[0]);
+    const uint8_t NUMBER_OF_CRITICAL_TASKS = 5;
+
+    msec_time_stamp_t lastRun[NUMBER_OF_TASKS];
+    uint32_t worstMicros[NUMBER_OF_TASKS];
+    uint8_t nextNonCritical = NUMBER_OF_CRITICAL_TASKS;
+
+    bool runIfDue(uint8_t i)
+    {
+        const auto now = millis();
+        uint16_t period = pgm_read_word(&Tasks[i].periodMsec);
+        if (period != 0 && now - lastRun[i] < period)
+            return false;
+        lastRun[i] = now;
+        auto run = reinterpret_cast<TaskFunction>(pgm_read_ptr(&Tasks[i].run));
+        auto start = micros();
+        run(now);
+        uint32_t took = micros() - start;
+        if (took > worstMicros[i])
+            worstMicros[i] = took;
+        return true;
+    }
+
+    void loop()
+    {
+        static_assert(sizeof(millis()) == sizeof(msec_time_stamp_t), "msec_time_stamp_t must match type of millis()");
+#if LOOP_PROFILE
+        const auto start = micros();
+#endif
+        for (uint8_t i = 0; i < NUMBER_OF_CRITICAL_TASKS; i++)
+            runIfDue(i);
+        for (uint8_t j = NUMBER_OF_CRITICAL_TASKS; j < NUMBER_OF_TASKS; j++)
+        {
+            uint8_t i = nextNonCritical;
+            if (++nextNonCritical >= NUMBER_OF_TASKS)
+                nextNonCritical = NUMBER_OF_CRITICAL_TASKS;
+            if (runIfDue(i))
+                break;
+        }
+        PROFILE_LOOP_PASS(micros() - start);
+    }
+}
+
+#if LOOP_PROFILE
+namespace {
+    void reportStats()
+    {
+        using namespace Profile;
+        stats.tag[0] = 'S'; stats.tag[1] = 'T';
+        stats.worstTask = 0;
+        for (uint8_t i = 0; i < Scheduler::NUMBER_OF_TASKS; i++)
+            if (Scheduler::worstMicros[i] > Scheduler::worstMicros[stats.worstTask])
+                stats.worstTask = i;
+        stats.worstTaskMicros = Scheduler::worstMicros[stats.worstTask];
+#if USE_SERIAL >= SERIAL_PORT_SETUP
+        Serial.print(F("Loop max msec: ")); Serial.println(stats.loopMaxMsec);
+        for (uint8_t i = 0; i < NUMBER_OF_LOOP_BUCKETS; i++)
+        {
+            Serial.print(' ');
+            Serial.print(stats.loopHistogram[i]);
+        }
+        Serial.println();
+        for (uint8_t i = 0; i < NUMBER_OF_BLOCKING_CALLS; i++)
+        {
+            Serial.print(F("Call ")); Serial.print((int)i);
+            Serial.print(F(" count: ")); Serial.print(stats.calls[i].count);
+            Serial.print(F(" max usec: ")); Serial.println(stats.calls[i].maxMicros);
+        }
+        for (uint8_t i = 0; i < Scheduler::NUMBER_OF_TASKS; i++)
+        {
+            Serial.print(F("Task ")); Serial.print((int)i);
+            Serial.print(F(" max usec: ")); Serial.println(Scheduler::worstMicros[i]);
+        }
+#endif
+        if (radioSetupOK)
+            RadioQueue::enqueue(RadioQueue::PACKET_RESPONSE, reinterpret_cast<const char *>(&stats), sizeof(stats));
+        memset(&stats, 0, sizeof(stats));
+    }
+}
+#endif
+
+namespace EepromLayout {
+    /* Adding a setting above moves HVAC_EEPROM_START, and with it every HVAC mode's settings. A unit
+    ** flashed with a sketch of another layout would read its HVAC settings from the wrong place.
+    ** Instead, setup() finds no matching marker at LAYOUT_VERSION, erases everything from
+    ** the first setting added after SCHEDULE_TEMPERATURE_ENTRIES to the end of EEPROM, and writes
+    ** the marker. The unit then starts in PassThrough and needs its configuration sent again.
+    ** The settings before TELEMETRY_FORMAT never moved, and are kept.
+    ** Bump VERSION with every change to EepromAddresses or to the HVAC.cpp layout.
+    ** The HVAC class flags in ThermostatCommon.h change which types have mode settings in EEPROM,
+    ** so each one turned off sets a high bit, and with all of them on VERSION stays as it was. */
+    const uint8_t MARKER = 'L';
+    const uint8_t VERSION = 1 | (HVAC_AUTO_CLASS ? 0 : 0x20) | (HVAC_PREDICTIVE_CLASS ? 0 : 0x40) |
+        (HVAC_RULES_CLASS ? 0 : 0x80);
+
+    void check()
+    {
+        const int addr = static_cast<int>(EepromAddresses::LAYOUT_VERSION);
+        if (EEPROM.read(addr) == MARKER && EEPROM.read(addr + 1) == VERSION)
+            return;
+#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
+        Serial.println(F("EEPROM layout changed. HVAC settings erased"));
+#endif
+        for (int i = static_cast<int>(EepromAddresses::TELEMETRY_FORMAT); i <= E2END; i++)
+        {
+            EEPROM.update(i, 0xff);
+            wdt_reset();
+        }
+        EEPROM.write(addr, MARKER);
+        EEPROM.write(addr + 1, VERSION);
     }
 }
 
@@ -1044,7 +2747,14 @@ void setup()
 
     digitalWrite(OUTREG_SPI_CS_PIN, HIGH);
     pinMode(OUTREG_SPI_CS_PIN, OUTPUT);
+    EepromLayout::check();
     displayLcdFarenheit = EEPROM.read(static_cast<int>(EepromAddresses::DISPLAY_UNITS_ADDRESS)) != 0;
+    binaryTelemetry = EEPROM.read(static_cast<int>(EepromAddresses::TELEMETRY_FORMAT)) == 1; // erased EEPROM is ASCII
+    groupId = EEPROM.read(static_cast<int>(EepromAddresses::GROUP_ID));
+    if (groupId == 0xff) // erased EEPROM
+        groupId = 0;
+    CompressorHoldSeconds = getCompressorHoldSeconds();
+    HeatSafetyHoldSeconds = getHeatSafetyHoldSeconds();
 
     Wire.begin();
     SPI.begin();
@@ -1068,6 +2778,9 @@ void setup()
     }
 
     LCD::init();
+#if SCHEDULE_ENTRIES
+    ScheduleIndex::rebuild();
+#endif
 
     // Initialize the RFM69HCW:
     bool ok = false;
@@ -1109,6 +2822,7 @@ void setup()
     LCD::printBanner(radioSetupOK ? "Radio OK" : "Radio No Good");
 
     analogReference(DEFAULT); // 3.3V full scale at 10 bits, which is 1023
+    AdcEngine::setup();
 
     pinMode(PCB_INPUT_X1_PIN, INPUT_PULLUP);
     pinMode(PCB_INPUT_X2_PIN, INPUT_PULLUP);
@@ -1117,317 +2831,64 @@ void setup()
     pinMode(PCB_INPUT_Z1_PIN, INPUT_PULLUP);
     pinMode(PCB_INPUT_Z2_PIN, INPUT_PULLUP);
     pinMode(PCB_INPUT_R_ACTIVE_PIN, INPUT_PULLUP);
+    InputCapture::setup();
 
     ThermostatCommon::setup();
+    RxFilter::update();
 
     wdt_enable(WDTO_8S);
 }
 
-void loop()
-{   wdt_reset();
-    const auto now = millis();
-    static_assert(sizeof(now) == sizeof(msec_time_stamp_t), "msec_time_stamp_t must match type of millis()");
-    auto previousInputRegister = InputRegister;
-    auto previousOutputRegister = OutputRegister;
-
-    {   // every second (or so) update the RTC time on the LCD
-        const unsigned long LCD_TIME_UPDATE_MSEC = 1000;
-        static unsigned long lastLCDupdate;
-        static bool firstTime=true;
-        static_assert(sizeof(lastLCDupdate) == sizeof(now), "lastLCDupdate wrong size");
-        int diff = now - lastLCDupdate;
-        if (diff > LCD_TIME_UPDATE_MSEC)
-        {
-            lastLCDupdate = now;
-            if (firstTime)
-                firstTime = false;
-            else
-            {
-                rtc.updateTime();
-                uint8_t hrs = rtc.getHours();
-                uint8_t min = rtc.getMinutes();
-                char *p = reportbuf;
-                if (hrs < 10)
-                    *p++ = '0';
-                else
-                {
-                    *p++ = '0' + hrs / 10;
-                    hrs %= 10;
-                }
-                *p++ = '0' + hrs;
-                *p++ = ':';
-                if (min < 10)
-                    *p++ = '0';
-                else
-                {
-                    *p++ = '0' + min / 10;
-                    min %= 10;
-                }
-                *p++ = '0' + min;
-                *p++ = 0;
-                LCD::printTime(&reportbuf[0]);
-                printHvacTemperatures();
-                LCD::printCompressorHold(CompressorOffTimeActive ? "H" : "");
-            }
-        }
-    }
-
-#if SCHEDULE_ENTRIES
-    {   // check schedule slightly faster than once per minute
-        const unsigned long SCEDULE_TIME_UPDATE_MSEC = 40000; // less than one minute
-        static unsigned long lastScheduleUpdate;
-        static_assert(sizeof(lastScheduleUpdate) == sizeof(now), "lastScheduleUpdate wrong size");
-        int diff = now - lastScheduleUpdate;
-        if (diff > SCEDULE_TIME_UPDATE_MSEC)
-        {
-            lastScheduleUpdate = now;
-            rtc.updateTime();
-            uint8_t hrs = rtc.getHours();
-            uint8_t mins = rtc.getMinutes();
-            int weekday = rtc.getWeekday();
-            for (uint8_t i = 0; i < NUM_SCHEDULE_TEMPERATURE_ENTRIES; i++)
-            {
-                auto se = getScheduleEntry(i);
-                if ((0 != ((int)se.DaysOfWeek & (1 << weekday))) &&
-                    hrs == static_cast<uint8_t>(se.TimeOfDayHour) &&
-                    mins == static_cast<uint8_t>(se.TimeOfDayMinute))
-                {
-                    setTemperatureCx10((int)se.degreesCx5 << 1, se.AutoMode);
-                    LCD::reinit = true;
-                }
-            }
-        }
-    }
-#endif
-
-    if (CompressorOffTimeActive && (now - CompressorOffStartTime) > 1000L * getCompressorHoldSeconds())
-    {   // deal with possible expiration of the compressor short cycle prevention timer
-        CompressorOffTimeActive = false;
-        Furnace::SetOutputBits();
-    }
-    if (HeatSafetyOffTimeActive)
-    {
-        if ((now - HeatSafetyOffStartTime) > 1000L * getHeatSafetyHoldSeconds())
-        {
-            HeatSafetyOffTimeActive = false;
-            LCD::printBanner(hvac->ModeNameString());
-            Furnace::SetOutputBits();
-        }
-    }
-    if (!HeatSafetyOffTimeActive)
-    {   // check inlet temperature in heat modes and shut down if EEPROM settings say so
-        auto heatSafetySeconds = getHeatSafetyHoldSeconds();
-        if (heatSafetySeconds > 0 && heatSafetySeconds != static_cast<uint16_t>(0xffff))
-        {
-            auto heatSafetyTempCx10 = getHeatSafetyTemperatureCx10();
-            if (heatSafetyTempCx10 > 0)
-            {
-                if (heatSafetyTempCx10 <= TinletTemperatureCx10)
-                {   // safety triggerred
-                    for (uint8_t i = 0; i < NUM_HEAT_SAFETY_ENTRIES; i++)
-                    {
-                        HeatSafetyMask_t m = getHeatSafetyMask(i);
-                        uint8_t bits = ~m.dontCareMask & Furnace::LastOutputWrite;
-                        if (bits == m.mustMatchMask && m.toClear != 0)
-                        { // table indicates this IS a heat mode, so shut down heat
-                            HeatSafetyOffStartTime = millis();
-                            HeatSafetyOffTimeActive = true;
-                            LCD::printBanner(HeatSafetyBanner);
-                            HeatSafetyShutoffMask = ~m.toClear;
-                            Furnace::SetOutputBits();
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    uint8_t inputsAsRead = 0;
-    {   // read input signals. mask definitions correspond with those in OutputRegister
-        uint8_t TempInputRegister = 0;
-        if (digitalRead(PCB_INPUT_X1_PIN) == LOW)
-            TempInputRegister |= 1 << BN_X1;
-        if (digitalRead(PCB_INPUT_X2_PIN) == LOW)
-            TempInputRegister |= 1 << BN_X2;
-        if (digitalRead(PCB_INPUT_Z1_PIN) == LOW)
-            TempInputRegister |= 1 << BN_Z1;
-        if (digitalRead(PCB_INPUT_Z2_PIN) == LOW)
-            TempInputRegister |= 1 << BN_Z2;
-        if (digitalRead(PCB_INPUT_W_PIN) == LOW)
-            TempInputRegister |= 1 << BN_W;
-        if (digitalRead(PCB_INPUT_ZX_PIN) == LOW)
-            TempInputRegister |= 1 << BN_ZX;
-        if (digitalRead(PCB_INPUT_R_ACTIVE_PIN) == LOW)
-            TempInputRegister |= 1 << BN_R;
-
-        // deal with 60Hz AC to input signal conversion
-        static msec_time_stamp_t LastSeenActive[NUMBER_OF_SIGNALS]; 
-        static msec_time_stamp_t LastChecked; 
-        static msec_time_stamp_t RestartedChecking; // some functions in loop() take longer than INPUT_AC_ACTIVE_MIN_MSEC
-        // when restarting checking after missing that long, don't turn off outputs until we've seen enough inputs
-
-        if (now - LastChecked >= INPUT_AC_ACTIVE_MIN_MSEC / 4) 
-            RestartedChecking = now;
-
-        uint8_t mask = 1;
-        for (uint8_t i = 0; i < NUMBER_OF_SIGNALS; i++, mask <<= 1)
-        {
-            if (TempInputRegister & mask)
-            {
-                LastSeenActive[i] = now;
-                InputRegister |= mask;
-            }
-            else 
-            {
-                if (static_cast<unsigned long>(now - LastSeenActive[i]) >= INPUT_AC_ACTIVE_MIN_MSEC &&
-                    static_cast<unsigned long>(now - RestartedChecking) >= INPUT_AC_ACTIVE_MIN_MSEC)
-                    InputRegister &= ~mask;
-            }
-        }
-        LCD::backLight(0 != (InputRegister & (1 << BN_R)));
-        LastChecked = now;
-        inputsAsRead = InputRegister;
-        if (previousInputRegister != InputRegister || InputsToHvacFlag) // hvac can CHANGE inputregister
-        {
-            hvac->OnInputsChanged(InputRegister, previousInputRegister);
-            Furnace::SetOutputBits();
-        }
-        InputsToHvacFlag = false;
-    }
-
-    {   // An ADC read takes a large number of cycles. Spread the 3 of them out through multiple loops
-        static unsigned long lastTemperatureAcquireMsec;
-        static enum {DO_T_INLET, DO_T_OUTLET, DO_OUTSIDE, DO_REPORT, WAIT_REPORT_INTERVAL} temperatureAcquireState;
-        uint16_t diffMsec = now - lastTemperatureAcquireMsec;
-        switch (temperatureAcquireState)
-        {
-            // the ADC reads are done on consecutive loop() calls
-            case DO_T_INLET:
-                if (diffMsec >= POLL_ADC_MSEC)
-                {   // stay in D_T_INLETT for POLL_ADC_MSEC msec
-                    auto vTi = analogRead(T_LM235_INLET_PIN); // Pro Micro has 10bit A/D
-                    TinletADCsum += vTi;
-                    temperatureAcquireState = DO_T_OUTLET;
-                }
-                break;
-            case DO_T_OUTLET:
-                {
-                    auto vTi = analogRead(T_LM235_OUTLET_PIN); // Pro Micro has 10bit A/D
-                    ToutletADCsum += vTi;
-                    temperatureAcquireState = DO_OUTSIDE;
-                }
-                break;
-            case DO_OUTSIDE:
-                 {
-                    auto vTi = analogRead(S1_7089U_OUTSIDE_PIN); // Pro Micro has 10bit A/D
-                    TexternalADCsum += vTi;
-                    numberReadsInSum += 1;
-                    if (numberReadsInSum >= NUMBER_TEMPERATURE_ADC_READS_TO_AVERAGE)
-                        temperatureAcquireState = DO_REPORT;
-                    else
-                        temperatureAcquireState = DO_T_INLET;
-                    lastTemperatureAcquireMsec = now;
-                }
-                break;
-            case DO_REPORT:
-                {
-                    radioTemperatureReport(TinletADCsum, ToutletADCsum, TexternalADCsum);
-                    TinletTemperatureCx10 = degreesCx10fromLM235ADCx64(TinletADCsum);
-                    lastTemperatureAcquireMsec = now;
-                    temperatureAcquireState  = WAIT_REPORT_INTERVAL;
-                }
-                break;
-            case WAIT_REPORT_INTERVAL:
-                if (diffMsec >= BETWEEN_REPORTING_TEMPERTURE_MSEC)
-                {
-                    TexternalADCsum = 0;
-                    ToutletADCsum = 0;
-                    TinletADCsum = 0;
-                    numberReadsInSum = 0;
-                    lastTemperatureAcquireMsec = now;
-                    temperatureAcquireState = DO_T_INLET;
-                }
-                break;
-        }
-    }
-
-    // check for Serial input
-#if USE_SERIAL >= SERIAL_PORT_PROMPT_ONLY
-    while (Serial.available())
+#if IDLE_SLEEP
+namespace Idle {
+    /* After each pass of loop(), halt the CPU in SLEEP_MODE_IDLE until the next interrupt. The
+    ** clocks keep running in idle, so millis(), the Timer3 input sampling, USB serial, SPI and I2C
+    ** all work as when awake, and every interrupt, including the RFM69 DIO0 interrupt, ends the sleep.
+    ** The deeper modes stop the clock Timer3 and Timer0 run from, and the 32U4 has no asynchronous
+    ** Timer2 to wake on, so they would lose millis() and the input debounce.
+    ** Timer0 interrupts every 2.048 msec at 8MHz and Timer3 at INPUT_SAMPLE_HZ, so work that
+    ** arrives while asleep, or while deciding to sleep, waits at most one Timer3 period.
+    ** loop() resets the watchdog once per pass, as before, so a task that hangs still trips it. */
+    void sleep()
     {
-        auto c = Serial.read();
-        if (c < 0)
-            break;
-        auto ch = static_cast<char>(c);
-        bool isRet = ch == '\n' || ch == '\r';
-        if (!isRet)
-            cmdbuf[charsInBuf++] = ch;
-        cmdbuf[charsInBuf] = 0;
-        if (isRet || charsInBuf >= CMD_BUFLEN - 1)
-        {
-            routeCommand(cmdbuf, charsInBuf);
-            Serial.println(F("ready>"));
-            charsInBuf = 0;
-        }
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        cli();
+        sleep_enable();
+        sei(); // the instruction after sei runs before any pending interrupt, so none is lost
+        sleep_cpu();
+        sleep_disable();
     }
+}
 #endif
 
-    // check radio
-    if (radio.receiveDone()) // Got a packet over the radio
-    {   // RFM69 ensures no trailing zero byte when buffer is full
-        memset(reportbuf, 0, sizeof(reportbuf));
-        memcpy(reportbuf, &radio.DATA[0], sizeof(radio.DATA));
-        bool toMe = radioConfiguration.NodeId() == radio.TARGETID;
-        if (toMe && radio.ACKRequested())
-            radio.sendACK();
-        routeCommand(reportbuf, sizeof(radio.DATA), static_cast<uint8_t>(radio.SENDERID), toMe);
-#if USE_SERIAL >= SERIAL_PORT_SETME_DEBUG_TO_SEE
-        Serial.print(F("FromRadio: \""));
-        Serial.print(reportbuf);
-        Serial.print(F("\" sender:"));
-        Serial.print(radio.SENDERID);
-        Serial.print(" target:");
-        Serial.println(radio.TARGETID);
+void loop()
+{   wdt_reset();
+    Scheduler::loop();
+#if IDLE_SLEEP
+    Idle::sleep();
 #endif
-    }
-
-    hvac->loop(now);
-    Furnace::loop(now);
-
-    if (LCD::reinit)
-    {   // the LCD display seems to get out of sync. Force a full update of it occasionally
-        LCD::printBanner(HeatSafetyOffTimeActive ? HeatSafetyBanner : hvac->ModeNameString());
-        lcdHvacReport(OutputRegister & OUTPUT_SIGNAL_MASK);
-        LCD::reinit = false;
-    }
-
-    LCD::loop(now);
-
-    if (  ((previousInputRegister  & INPUT_SIGNAL_MASK ) != (InputRegister  & INPUT_SIGNAL_MASK)) 
-        || (previousOutputRegister != OutputRegister ))
-        radioHvacReport(inputsAsRead, OutputRegister);
 }
 
-/* macros to simplify compile-time generation of the C7089U coefficients that are optimized for least run-time
+/* macros to simplify compile-time generation of the C7089U table that is optimized for least run-time
 ** arduino computation. */
 
 #define ADCfromRESISTANCE(resistance) ((static_cast<double>(NUMBER_TEMPERATURE_ADC_READS_TO_AVERAGE) * (resistance) * ADCmaxVoltageCount * IsenseAmps / ADCmaxVoltage))
 #define FtoC(farenheit) (((farenheit) - 32.0) * 5.0 / 9.0)
-#define MAKEC7089U(farenheit, celsius, resistance, Rprev, Tprev) { static_cast<int16_t>(0.5 + FtoC(farenheit)*10), \
-    static_cast<uint16_t>(0.5 + ADCfromRESISTANCE(resistance)), \
-    static_cast<uint16_t>(0.5 + ((1L << POWER2_C7089SlopeScale) * 10.0 * (FtoC(farenheit) - FtoC(Tprev)) / (ADCfromRESISTANCE(Rprev) - ADCfromRESISTANCE(resistance))))  \
-    } 
+#define MAKEC7089U(farenheit, celsius, resistance, Rprev, Tprev) { FtoC(farenheit) * 10, ADCfromRESISTANCE(resistance) } 
 
 namespace
 {
     // the Rset for the LM334 is 2.2K, which the data sheet says gives 67.7mV/2.2K = 30.77 uA
-    const double IsenseAmps = .0677 / 2200;
+    constexpr double IsenseAmps = .0677 / 2200;
+    struct C7089UPoint_t {
+        double TCelsiusX10;
+        double ADCx64; // corresponding ADC value, multiplied by 64
+    };
     // these coefficients are copied and pasted from the Honeywell C7089U specification, with
-    // the addition of two columns. These extra columns are the resistance and the temperature
-    // repeated one line lower, which allows compile-time generation of the "slope" entry in
-    // the table.
-    const C7089UCoefficient_t C7089UCoefficients[NUM_C7089_COEFFICIENTS] PROGMEM =
+    // the addition of two columns, no longer used. They are the resistance and the temperature
+    // repeated one line lower.
+    // Only the compiler reads this table. It generates C7089UTable, below.
+    constexpr C7089UPoint_t C7089UPoints[] =
     {
 #if 0
     /*  With a 3.3V ADC and a 2.2K Rset (=30.7uA), the maximum R that can be digitized is 107.5K ohms */
@@ -1519,4 +2980,58 @@ namespace
     MAKEC7089U(125.6	,	52	,	3896	,	4026	,	123.8), // adc: 2375
     MAKEC7089U(127.4	,	53	,	3771	,	3896	,	125.6), // adc: 2299
     };
+    constexpr unsigned NUM_C7089U_POINTS = sizeof(C7089UPoints) / sizeof(C7089UPoints[0]);
+
+    // Honeywell temperature at ADCx64, linearly interpolated between the points. Extrapolated past the ends
+    constexpr double C7089UCx10At(double ADCx64, unsigned j = 0)
+    {
+        return (j + 2 >= NUM_C7089U_POINTS || ADCx64 >= C7089UPoints[j + 1].ADCx64)
+            ? C7089UPoints[j].TCelsiusX10 + (C7089UPoints[j + 1].TCelsiusX10 - C7089UPoints[j].TCelsiusX10) *
+                (C7089UPoints[j].ADCx64 - ADCx64) / (C7089UPoints[j].ADCx64 - C7089UPoints[j + 1].ADCx64)
+            : C7089UCx10At(ADCx64, j + 1);
+    }
+    constexpr int16_t roundToInt16(double v) { return static_cast<int16_t>(v < 0 ? v - 0.5 : v + 0.5); }
+
+#define C7089U_TABLE_ENTRY(i) roundToInt16(C7089UCx10At(static_cast<double>(i) * (1ul << POWER2_C7089U_TABLE_STEP)))
+#define C7089U_TABLE_ENTRY4(i) C7089U_TABLE_ENTRY(i), C7089U_TABLE_ENTRY(i+1), C7089U_TABLE_ENTRY(i+2), C7089U_TABLE_ENTRY(i+3)
+#define C7089U_TABLE_ENTRY16(i) C7089U_TABLE_ENTRY4(i), C7089U_TABLE_ENTRY4(i+4), C7089U_TABLE_ENTRY4(i+8), C7089U_TABLE_ENTRY4(i+12)
+#define C7089U_TABLE_ENTRY64(i) C7089U_TABLE_ENTRY16(i), C7089U_TABLE_ENTRY16(i+16), C7089U_TABLE_ENTRY16(i+32), C7089U_TABLE_ENTRY16(i+48)
+    static_assert(NUM_C7089U_TABLE_ENTRIES == 129, "C7089UTable initializer below assumes 129 entries");
+    constexpr int16_t C7089UTable[NUM_C7089U_TABLE_ENTRIES] PROGMEM =
+    {
+        C7089U_TABLE_ENTRY64(0), C7089U_TABLE_ENTRY64(64), C7089U_TABLE_ENTRY(128)
+    };
+    constexpr uint16_t C7089U_MIN_ADCx64 = static_cast<uint16_t>(0.5 + C7089UPoints[NUM_C7089U_POINTS - 1].ADCx64);
+    constexpr uint16_t C7089U_MAX_ADCx64 = static_cast<uint16_t>(0.5 + C7089UPoints[0].ADCx64);
+
+    // The same arithmetic as degreesCx10FromC7089ADC
+    constexpr int16_t C7089UTableAt(uint16_t ADCx64)
+    {
+        return C7089UTable[ADCx64 >> POWER2_C7089U_TABLE_STEP] - static_cast<int16_t>(
+            ((C7089UTable[ADCx64 >> POWER2_C7089U_TABLE_STEP] - C7089UTable[(ADCx64 >> POWER2_C7089U_TABLE_STEP) + 1]) *
+                static_cast<uint32_t>(ADCx64 & ((1u << POWER2_C7089U_TABLE_STEP) - 1)) + (1u << (POWER2_C7089U_TABLE_STEP - 1)))
+                >> POWER2_C7089U_TABLE_STEP);
+    }
+    constexpr double absDouble(double v) { return v < 0 ? -v : v; }
+
+    const int16_t C7089U_MAX_ERROR_Cx10 = 2; // 0.2C
+    constexpr bool C7089UTableMatchesPoints(unsigned j = 0)
+    {
+        return j >= NUM_C7089U_POINTS ||
+            (absDouble(C7089UTableAt(static_cast<uint16_t>(0.5 + C7089UPoints[j].ADCx64)) - C7089UPoints[j].TCelsiusX10) <= C7089U_MAX_ERROR_Cx10 &&
+             C7089UTableMatchesPoints(j + 1));
+    }
+    static_assert(C7089UTableMatchesPoints(), "C7089UTable disagrees with the Honeywell data");
+
+    // degreesCx10FromC7089ADC clamps to these, so its idx is one of them and it reads C7089UTable[idx + 1]
+    constexpr unsigned C7089U_FIRST_INDEX = C7089U_MIN_ADCx64 >> POWER2_C7089U_TABLE_STEP;
+    constexpr unsigned C7089U_LAST_INDEX = C7089U_MAX_ADCx64 >> POWER2_C7089U_TABLE_STEP;
+    static_assert(C7089U_LAST_INDEX + 1 < NUM_C7089U_TABLE_ENTRIES, "C7089U lookup reads past C7089UTable");
+    constexpr bool C7089UTableStepsFit16(unsigned i = C7089U_FIRST_INDEX)
+    {   // degreesCx10FromC7089ADC multiplies the step by the fraction in 16 bits
+        return i > C7089U_LAST_INDEX ||
+            ((static_cast<uint32_t>(C7089UTable[i] - C7089UTable[i + 1]) << POWER2_C7089U_TABLE_STEP) <= 0xffffu &&
+             C7089UTableStepsFit16(i + 1));
+    }
+    static_assert(C7089UTableStepsFit16(), "C7089UTable step too large for 16 bit interpolation");
 }
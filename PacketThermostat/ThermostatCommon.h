@@ -1,5 +1,6 @@
 #pragma once
 #include "PcbSignalDefinitions.h"
+#include "CommandTokens.h"
 // values for USE_SERIAL. each one uses a bit more program memory
 #define SERIAL_PORT_OFF 0 // If you use this, you can't set the radio parameters on the serial port.
 #define SERIAL_PORT_PROMPT_ONLY 1
@@ -10,6 +11,26 @@
 
 #define USE_SERIAL SERIAL_PORT_VERBOSE   
 #define HVAC_AUTO_CLASS 1 // not enough program memory for all features? Turn this off.
+#define HVAC_PREDICTIVE_CLASS 1 // ...or this one
+#define HVAC_RULES_CLASS 1 // ...or this one
+#define LOOP_PROFILE 0 // 1 records loop() and blocking call times for the STATS command. Costs program memory and RAM
+#define IDLE_SLEEP 1 // 1 halts the CPU between loop() passes until the next interrupt. Any interrupt wakes it
+
+#if LOOP_PROFILE
+namespace Profile {
+    enum BlockingCall { RADIO_SEND, LCD_WRITE, RTC_UPDATE, ANALOG_READ, EEPROM_PUT, NUMBER_OF_BLOCKING_CALLS };
+    void add(BlockingCall, unsigned long microsTaken);
+    struct Scope { // times the rest of the enclosing block
+        Scope(BlockingCall w) : which(w), start(micros()) {}
+        ~Scope() { add(which, micros() - start); }
+        BlockingCall which;
+        unsigned long start;
+    };
+}
+#define PROFILE_SCOPE(w) Profile::Scope profileScope(Profile::w)
+#else
+#define PROFILE_SCOPE(w)
+#endif
 
 namespace Furnace {
     void UpdateOutputs(uint8_t mask);
@@ -24,10 +45,13 @@ struct ThermostatCommon
 {
 public:
     static void setup();
+    static void loopCommit(msec_time_stamp_t now); // HVAC COMMIT is deferred until settings stop changing
     virtual void OnInputsChanged(uint8_t inputs, uint8_t previous)=0;
-    virtual bool ProcessCommand(const char *cmd, uint8_t len, uint8_t senderid, bool toMe)= 0;
+    virtual bool ProcessCommand(const CommandView &cmd, uint8_t senderid)= 0;
     virtual const char *ModeNameString() = 0;
     virtual bool GetTargetAndActual(int16_t &targetCx10, int16_t &actualCx10) = 0;
+    virtual void SetTargetCx10(int16_t targetCx10) = 0; // as HVAC_SETTINGS <target> does
+    virtual uint32_t SensorMask() = 0; // sender IDs whose thermometer reports this mode reads
     virtual void loop(msec_time_stamp_t now) = 0;
     uint8_t TypeNumber() const { return MyTypeNumber; }
     uint8_t ModeNumber() const { return MyModeNumber; }
@@ -39,5 +63,6 @@ protected:
 
 extern ThermostatCommon *hvac;
 extern const int HVAC_EEPROM_START;
+extern const int SETPOINT_RING_START; // HVAC.cpp owns the EEPROM from here to E2END
 extern const char HVAC_SETTINGS[];
 extern const char AUTO_SETTINGS[];
@@ -0,0 +1,451 @@
+/* Keep the gateway's serial port open and share it among local clients.
+**
+** Clients connect to a unix domain socket and send one request per line:
+**      <nodeid> <command>
+** and receive one line per request once it completes:
+**      <nodeid> OK <command>
+**      <nodeid> FAIL <command>
+** The line "STATUS" instead gets the number of queued commands for each node.
+**
+** Each node has its own queue. Nodes are served round robin, one command at a time on the serial port,
+** so a dozen thermostats behind one gateway share it fairly. A command is forwarded to the gateway as
+**      <gateway prefix> <nodeid> <command>
+** and it completes at the next "ready>" prompt. It succeeded if a line before that prompt starts with
+** the ACK text as a whole word, so "NO ACK" is not success. Otherwise it is retried, up to MAX_ATTEMPTS.
+** An attempt that times out may still get its "ready>" late, and that prompt must not complete the
+** next command, so nothing more is sent until it arrives or STALE_PROMPT_MSEC passes. With an empty gateway prefix, the port is
+** a Packet Thermostat itself, the nodeid is ignored, and every "ready>" is success.
+**
+** A setpoint command for a node replaces the same queued, not yet sent, setpoint command for that node,
+** as long as it has at least as many fields. The firmware keeps the fields a shorter one leaves off, so
+** a shorter one is queued after the longer. Both clients get the reply of the one sent.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "SerialPortLinux.h"
+#include "PromptMatcher.h"
+#include "GatewayDaemon.h"
+
+namespace PacketThermostat {
+namespace {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned MAX_ATTEMPTS = 3;
+    const unsigned ATTEMPT_TIMEOUT_MSEC = 5000; // covers the gateway's own radio retries
+    const unsigned STALE_PROMPT_MSEC = 5000; // after a timeout, how long to wait for its late prompt
+    const size_t MAX_CLIENT_LINE = 200;
+
+    /* Setpoint commands whose later copy makes the earlier one pointless. "SE <n>" is per entry.
+    ** Anything else, HVAC MODE= for example, changes what the setpoint commands mean, so
+    ** merging never looks back past it */
+    std::string MergeKey(const std::string &cmd)
+    {
+        static const char * const SETPOINTS[] = { "HVAC_SETTINGS", "AUTO_SETTINGS", "HUM_SETTINGS", "HVAC FAN=" };
+        std::string upper(cmd);
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        for (auto p : SETPOINTS)
+            if (upper.compare(0, strlen(p), p) == 0)
+                return p;
+        if (upper.compare(0, 3, "SE ") == 0)
+        {
+            std::istringstream iss(upper.substr(3));
+            unsigned which;
+            if (iss >> which)
+                return "SE " + std::to_string(which);
+        }
+        return std::string();
+    }
+
+    unsigned FieldCount(const std::string &cmd, const std::string &key)
+    {   // the blank separated fields after key. HVAC_SETTINGS and the like set only the fields given
+        std::istringstream iss(cmd.substr(std::min(key.size(), cmd.size())));
+        unsigned count = 0;
+        for (std::string field; iss >> field;)
+            count += 1;
+        return count;
+    }
+
+    bool LineStartsWithWord(const std::string &text, const std::string &word)
+    {   // some line of text, leading space skipped, is word alone or word and then a non-alphanumeric
+        size_t start = 0;
+        while (start < text.size())
+        {
+            size_t end = text.find_first_of("\r\n", start);
+            if (end == text.npos)
+                end = text.size();
+            size_t p = text.find_first_not_of(" \t", start);
+            if (p < end && text.compare(p, word.size(), word) == 0 &&
+                (p + word.size() == end || !isalnum(static_cast<unsigned char>(text[p + word.size()]))))
+                return true;
+            start = end + 1;
+        }
+        return false;
+    }
+
+    struct Request {
+        std::string cmd;
+        std::string key; // empty if never merged
+        unsigned fields; // FieldCount of cmd
+        std::vector<int> clients;
+        unsigned attempts;
+    };
+
+    class Daemon {
+    public:
+        Daemon(SerialPort &port, const std::string &gatewayPrefix, const std::string &ackText) :
+            m_port(port), m_gatewayPrefix(gatewayPrefix), m_ackText(ackText), m_listen(-1),
+            m_busy(false), m_busyNode(0), m_lastNode(0), m_stale(false), m_sendWaiting(false), m_ready("ready>")
+        {
+            std::transform(m_ackText.begin(), m_ackText.end(), m_ackText.begin(),
+                [](unsigned char c) { return static_cast<char>(::tolower(c)); });
+        }
+        ~Daemon()
+        {
+            for (auto &c : m_clients)
+                ::close(c.first);
+            if (m_listen >= 0)
+            {
+                ::close(m_listen);
+                ::unlink(m_socketPath.c_str());
+            }
+        }
+        bool Listen(const std::string &path);
+        void Run();
+    private:
+        void Accept();
+        void ReadClient(int fd);
+        void DropClient(int fd);
+        void Enqueue(int fd, unsigned node, const std::string &cmd);
+        void StartNext();
+        void Send();
+        void Write();
+        void EndStale();
+        void OnSerial(const unsigned char *buf, unsigned len);
+        void Complete(bool ok);
+        void Reply(const std::vector<int> &clients, const std::string &line);
+
+        SerialPort &m_port;
+        const std::string m_gatewayPrefix;
+        std::string m_ackText;
+        std::string m_socketPath;
+        int m_listen;
+        std::map<int, std::string> m_clients; // fd to partial line
+        std::map<unsigned, std::deque<Request> > m_queues;
+        bool m_busy; // the front of m_queues[m_busyNode] is on the serial port
+        unsigned m_busyNode;
+        unsigned m_lastNode; // round robin position
+        Clock::time_point m_deadline;
+        bool m_stale; // an attempt timed out and its prompt has not come yet
+        bool m_sendWaiting; // Send() was called while m_stale
+        Clock::time_point m_staleUntil;
+        std::string m_response; // serial text since the command was sent
+        PromptMatcher m_ready;
+    };
+
+    bool Daemon::Listen(const std::string &path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+            return false;
+        strcpy(addr.sun_path, path.c_str());
+        m_listen = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_listen < 0)
+            return false;
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            ::unlink(path.c_str()); // left over from a previous run. Anything else there makes bind fail
+        if (::bind(m_listen, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || ::listen(m_listen, 16) < 0)
+        {
+            ::close(m_listen);
+            m_listen = -1;
+            return false;
+        }
+        m_socketPath = path;
+        return true;
+    }
+
+    void Daemon::Run()
+    {
+        for (;;)
+        {
+            std::vector<struct pollfd> fds;
+            fds.push_back({ m_listen, POLLIN, 0 });
+            fds.push_back({ m_port.fd(), POLLIN, 0 });
+            for (auto &c : m_clients)
+                fds.push_back({ c.first, POLLIN, 0 });
+            int timeout = -1;
+            if (m_busy || m_stale)
+                timeout = static_cast<int>(std::max<long long>(0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        (m_stale ? m_staleUntil : m_deadline) - Clock::now()).count()));
+            int res = ::poll(&fds[0], fds.size(), timeout);
+            if (res < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                std::cerr << "poll failed " << strerror(errno) << std::endl;
+                return;
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                unsigned char buf[256];
+                unsigned nr = 0;
+                if (!m_port.Read(buf, sizeof(buf), &nr, 0))
+                {
+                    std::cerr << "serial port read failed" << std::endl;
+                    return;
+                }
+                OnSerial(buf, nr);
+            }
+            else if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                std::cerr << "serial port closed" << std::endl;
+                return;
+            }
+            if (m_stale && Clock::now() >= m_staleUntil)
+                EndStale(); // the prompt never came
+            else if (m_busy && !m_stale && Clock::now() >= m_deadline)
+            {
+                m_stale = true;
+                m_staleUntil = Clock::now() + std::chrono::milliseconds(STALE_PROMPT_MSEC);
+                Complete(false);
+            }
+            for (size_t i = 2; i < fds.size(); i++)
+                if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    ReadClient(fds[i].fd);
+            if (fds[0].revents & POLLIN)
+                Accept();
+            StartNext();
+        }
+    }
+
+    void Daemon::Accept()
+    {
+        int fd = ::accept(m_listen, 0, 0);
+        if (fd >= 0)
+            m_clients[fd];
+    }
+
+    void Daemon::ReadClient(int fd)
+    {
+        char buf[256];
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                return;
+            DropClient(fd);
+            return;
+        }
+        auto &pending = m_clients[fd];
+        pending.append(buf, n);
+        size_t eol;
+        while ((eol = pending.find('\n')) != pending.npos)
+        {
+            std::string line = pending.substr(0, eol);
+            pending.erase(0, eol + 1);
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line == "STATUS")
+            {
+                std::ostringstream oss;
+                for (auto &q : m_queues)
+                    if (!q.second.empty())
+                        oss << q.first << ":" << q.second.size() << " ";
+                Reply({ fd }, "STATUS " + oss.str());
+                continue;
+            }
+            std::istringstream iss(line);
+            unsigned node;
+            std::string cmd;
+            if (!(iss >> node) || !std::getline(iss >> std::ws, cmd) || cmd.empty())
+            {
+                Reply({ fd }, "FAIL " + line);
+                continue;
+            }
+            Enqueue(fd, node, cmd);
+        }
+        if (pending.size() > MAX_CLIENT_LINE)
+            DropClient(fd);
+    }
+
+    void Daemon::DropClient(int fd)
+    {   // its queued requests still go out. Nobody hears the reply
+        ::close(fd);
+        m_clients.erase(fd);
+        for (auto &q : m_queues)
+            for (auto &r : q.second)
+                r.clients.erase(std::remove(r.clients.begin(), r.clients.end(), fd), r.clients.end());
+    }
+
+    void Daemon::Enqueue(int fd, unsigned node, const std::string &cmd)
+    {
+        auto &q = m_queues[node];
+        std::string key = MergeKey(cmd);
+        unsigned fields = key.empty() ? 0 : FieldCount(cmd, key);
+        if (!key.empty())
+        {   // look back through the unsent setpoints for the same one
+            size_t first = (m_busy && m_busyNode == node) ? 1 : 0;
+            for (size_t i = q.size(); i > first; i--)
+            {
+                auto &r = q[i - 1];
+                if (r.key.empty())
+                    break;
+                if (r.key == key)
+                {
+                    if (fields < r.fields)
+                        break; // it would lose fields r sets
+                    r.cmd = cmd;
+                    r.fields = fields;
+                    r.clients.push_back(fd);
+                    return;
+                }
+            }
+        }
+        q.push_back({ cmd, key, fields, { fd }, 0 });
+    }
+
+    void Daemon::StartNext()
+    {
+        if (m_busy || m_queues.empty())
+            return;
+        auto it = m_queues.upper_bound(m_lastNode); // next node after the last one served
+        for (size_t n = 0; n < m_queues.size(); n++, it++)
+        {
+            if (it == m_queues.end())
+                it = m_queues.begin();
+            if (!it->second.empty())
+            {
+                m_busy = true;
+                m_busyNode = m_lastNode = it->first;
+                Send();
+                return;
+            }
+        }
+    }
+
+    void Daemon::Send()
+    {
+        if (m_stale)
+            m_sendWaiting = true; // EndStale writes it
+        else
+            Write();
+    }
+
+    void Daemon::EndStale()
+    {
+        m_stale = false;
+        if (m_sendWaiting)
+        {
+            m_sendWaiting = false;
+            Write();
+        }
+    }
+
+    void Daemon::Write()
+    {
+        auto &r = m_queues[m_busyNode].front();
+        r.attempts += 1;
+        std::ostringstream oss;
+        if (!m_gatewayPrefix.empty())
+            oss << m_gatewayPrefix << " " << m_busyNode << " ";
+        oss << r.cmd << '\r';
+        m_response.clear();
+        m_deadline = Clock::now() + std::chrono::milliseconds(ATTEMPT_TIMEOUT_MSEC);
+        if (!m_port.Write(oss.str()))
+            m_deadline = Clock::now(); // counts as a failed attempt
+    }
+
+    void Daemon::OnSerial(const unsigned char *buf, unsigned len)
+    {
+        for (unsigned i = 0; i < len; i++)
+        {
+            char c = static_cast<char>(buf[i]);
+            if (m_stale)
+            {   // the timed out attempt's output. Its prompt ends it
+                if (m_ready.Feed(c))
+                    EndStale();
+                continue;
+            }
+            if (!m_busy)
+                continue; // unsolicited gateway output, for example a thermometer report
+            m_response.push_back(static_cast<char>(tolower(buf[i])));
+            if (m_ready.Feed(c))
+                Complete(m_ackText.empty() || LineStartsWithWord(m_response, m_ackText));
+        }
+    }
+
+    void Daemon::Complete(bool ok)
+    {
+        auto &q = m_queues[m_busyNode];
+        auto &r = q.front();
+        if (!ok && r.attempts < MAX_ATTEMPTS)
+        {
+            Send(); // try again
+            return;
+        }
+        std::ostringstream oss;
+        oss << m_busyNode << (ok ? " OK " : " FAIL ") << r.cmd;
+        Reply(r.clients, oss.str());
+        q.pop_front();
+        m_busy = false;
+    }
+
+    void Daemon::Reply(const std::vector<int> &clients, const std::string &line)
+    {
+        std::string s = line + "\n";
+        for (int fd : clients)
+            ::send(fd, s.c_str(), s.size(), MSG_NOSIGNAL); // a client that can't keep up misses replies
+    }
+}
+
+int RunGatewayDaemon(SerialPort &port, int argc, char **argv)
+{
+    std::string socketPath;
+    std::string gatewayPrefix = "SendMessageToNode";
+    std::string ackText = "ACK";
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-G") == 0 && i + 1 < argc)
+            gatewayPrefix = argv[++i];
+        else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc)
+            ackText = argv[++i];
+        else if (socketPath.empty())
+            socketPath = argv[i];
+    }
+    if (socketPath.empty())
+    {
+        std::cerr << "DAEMON needs a socket path" << std::endl;
+        return 1;
+    }
+    if (gatewayPrefix.empty())
+        ackText.clear();
+    ::signal(SIGPIPE, SIG_IGN);
+    Daemon daemon(port, gatewayPrefix, ackText);
+    if (!daemon.Listen(socketPath))
+    {
+        std::cerr << "can't listen on " << socketPath << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    daemon.Run();
+    return 1;
+}
+}
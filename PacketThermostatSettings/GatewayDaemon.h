@@ -0,0 +1,6 @@
+#pragma once
+namespace PacketThermostat {
+class SerialPort;
+// Serve a local socket until killed. returns non-zero on failure to start
+int RunGatewayDaemon(SerialPort &port, int argc, char **argv);
+}
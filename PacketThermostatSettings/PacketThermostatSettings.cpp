@@ -38,8 +38,21 @@ THE SOFTWARE.
 #include <functional>
 #include <stdexcept>
 #include <algorithm>
+#include <deque>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <mutex>
 
 #include <PacketThermostat/PcbSignalDefinitions.h>
+#include "PromptMatcher.h"
+#ifndef WIN32
+#include "GatewayDaemon.h"
+#endif
 #ifdef WIN32
 #include "SerialPortWin.h"
 #else
@@ -59,20 +72,20 @@ public:
         m_write = [this] (const std::string &s)
         {
             std::cout << s << std::endl;
-            m_readState = 0;
+            m_readState += 1; // number of "ready>" prompts owed
             return true;
         };
-        m_read = [this] (unsigned char* buf, unsigned len, unsigned* bytesRead)
+        m_read = [this] (unsigned char* buf, unsigned len, unsigned* bytesRead, unsigned)
         {
-            if (m_readState == 0)
+            static const char READY[] = "ready>";
+            static const unsigned READY_LEN = sizeof(READY) - 1;
+            *bytesRead = 0;
+            while (m_readState > 0 && *bytesRead + READY_LEN <= len)
             {
-                static const char READY[] = "ready>";
-                strncpy_s(reinterpret_cast<char*>(buf), len, READY, len-1);
-                *bytesRead = std::min(len, static_cast<unsigned>(sizeof(READY) / sizeof(READY[0])));
+                memcpy(buf + *bytesRead, READY, READY_LEN);
+                *bytesRead += READY_LEN;
+                m_readState -= 1;
             }
-            else
-                *bytesRead = 0;
-            m_readState = 1;
             return true;
         };
     }
@@ -83,19 +96,21 @@ public:
         m_write = std::bind(static_cast<bool (PacketThermostat::SerialPort:: *)(const std::string&)>(&PacketThermostat::SerialPort::Write), 
             m_sp.get(), std::placeholders::_1);
         m_read = std::bind(&PacketThermostat::SerialPort::Read, 
-            m_sp.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3);
+            m_sp.get(), std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
     }
     bool Write(const std::string &s)
     {
         return m_write(s);
     }
-    bool Read(unsigned char*buf, unsigned len, unsigned*bytesRead)
-    {
-        return m_read(buf, len, bytesRead);
+    bool Read(unsigned char*buf, unsigned len, unsigned*bytesRead, unsigned timeoutMsec = 100)
+    {   // returns as soon as any bytes arrive
+        return m_read(buf, len, bytesRead, timeoutMsec);
     }
+    // when several ports run at once, each line of their output is prefixed with this
+    std::string m_echoPrefix;
 protected:
     std::function<bool(const std::string &)> m_write;
-    std::function<bool(unsigned char* , unsigned , unsigned* )> m_read;
+    std::function<bool(unsigned char* , unsigned , unsigned*, unsigned )> m_read;
     std::unique_ptr<PacketThermostat::SerialPort> m_sp;
     int m_readState;
 };
@@ -120,11 +135,12 @@ namespace {
     const uint8_t MASK_DH = 1 << BN_ZX;
     const uint8_t MAX_AUXFAN = 1 << BN_X3; // aux or booster fan output. 
 
-    // The default for this program is to support the O wire reversing valve logic. Command line -B switches to B wire logic.
-    uint8_t MASK_O = 1 << BN_X1; 
-    uint8_t MASK_B = 0;
-
     int doConfigure(SerialWrapper&, int argc, char **argv);
+    int doGroup(SerialWrapper&, int argc, char **argv);
+    int doImage(SerialWrapper&, int argc, char **argv);
+
+    // must match PacketThermostat.ino. The firmware processes a command on CR or when this fills
+    const unsigned CMD_BUFLEN = 80;
 }
 
 struct WaitFailed : public std::runtime_error
@@ -133,52 +149,120 @@ struct WaitFailed : public std::runtime_error
     {}
 };
 
+int runCommand(SerialWrapper &sp, const std::string &cmdUpper, int argc, char **argv);
+
 
 int main(int argc, char **argv)
 {
     static const char *USAGE1 = 
-        "usage: PacketThermostatSettings [<COMMPORT> | - ] CONFIGURE -s <thermometer#1> -s <thermometer#2> ... -s <thermometer#n>";
+        "usage: PacketThermostatSettings [<COMMPORT> | - ] CONFIGURE [-P] -s <thermometer#1> -s <thermometer#2> ... -s <thermometer#n>\n"
+        "    -P streams the commands without waiting for each one, and uses the multi-entry\n"
+        "       HVACMAP and SE commands. It requires firmware that supports them.\n"
+        "usage: PacketThermostatSettings <COMMPORT> DAEMON [-G <gateway prefix>] [-A <ack text>] <socket path>\n"
+        "    keeps COMMPORT open and forwards \"<nodeid> <command>\" lines from clients of the socket.\n"
+        "    Default gateway prefix is SendMessageToNode and ack text is ACK. -G \"\" talks to a thermostat directly.\n"
+        "usage: PacketThermostatSettings [<COMMPORT> | - ] GROUP [-G <gateway prefix>] [-R <repeats>] [-S <sequence>] <group id> <command>\n"
+        "    sends <command> to every thermostat with GROUP=<group id> in one radio packet. 255 is all of them.\n"
+        "    The packet is not ACKed, so it is sent <repeats> times, default 3, with the same <sequence>.\n"
+        "usage: PacketThermostatSettings <COMMPORT> IMAGE READ <file>\n"
+        "       PacketThermostatSettings <COMMPORT> IMAGE WRITE <file>\n"
+        "    READ saves the unit's EEPROM image, all but the radio configuration, to <file>. WRITE sends the\n"
+        "    blocks of <file> that differ from the unit's, checks them, and restarts the unit to use them.\n"
+        "COMMPORT may be a comma separated list of ports. The command then runs on all of them at once.\n"
+        "    Not for DAEMON or IMAGE.";
     if (argc < 3)
     {
         std::cerr << USAGE1 << std::endl;
         return 1;
     }
 
+    std::string cmdUpper;
+    const char *p = argv[2];
+    while (*p)
+        cmdUpper.push_back(toupper(*p++));
+
     std::unique_ptr<SerialWrapper> sp;
 
     if (strcmp(argv[1],"-") == 0) // write commands to STDOUT instead of COM port
     {
         sp.reset(new SerialWrapper());
+        return runCommand(*sp.get(), cmdUpper, argc, argv);
     }
-    else
+
+    std::vector<std::string> portNames;
+    {   // COMMPORT,COMMPORT,... runs the command on each at once
+        std::istringstream names(argv[1]);
+        std::string name;
+        while (std::getline(names, name, ','))
+            if (!name.empty())
+                portNames.push_back(name);
+    }
+    bool severalPorts = portNames.size() > 1;
+    if (severalPorts && (cmdUpper == "DAEMON" || cmdUpper == "IMAGE"))
+    {
+        std::cerr << argv[2] << " takes only one COMMPORT" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<SerialWrapper>> ports;
+    for (auto &name : portNames)
     {
         static const int BAUD = 9600;
-        std::unique_ptr<PacketThermostat::SerialPort> port(new PacketThermostat::SerialPort(argv[1], BAUD));
+        std::unique_ptr<PacketThermostat::SerialPort> port(new PacketThermostat::SerialPort(name.c_str(), BAUD));
         if (port->OpenCommPort() < 0)
         {
-            std::cerr << "failed to open Serial Port" << std::endl;
+            std::cerr << "failed to open Serial Port " << name << std::endl;
             return 1;
         }
-        sp.reset(new SerialWrapper(port));
+#ifndef WIN32
+        if (cmdUpper == "DAEMON")
+            return PacketThermostat::RunGatewayDaemon(*port, argc, argv);
+#endif
+        ports.emplace_back(new SerialWrapper(port));
+        if (severalPorts)
+            ports.back()->m_echoPrefix = name + ": ";
     }
+    if (ports.size() == 1)
+        return runCommand(*ports[0], cmdUpper, argc, argv);
+
+    /* Each port gets its own thread. The SerialPort reads wait in poll(2), or on an overlapped
+    ** read on Windows, so each round trip still ends as soon as its "ready>" arrives. */
+    std::vector<int> results(ports.size(), 1);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < ports.size(); i++)
+        threads.emplace_back([&, i] { results[i] = runCommand(*ports[i], cmdUpper, argc, argv); });
+    int ret = 0;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+        if (results[i] != 0)
+        {
+            std::cerr << portNames[i] << " failed" << std::endl;
+            ret = 1;
+        }
+    }
+    return ret;
+}
 
-    std::string cmdUpper;
-    const char *p = argv[2];
-    while (*p)
-        cmdUpper.push_back(toupper(*p++));
-
+int runCommand(SerialWrapper &sp, const std::string &cmdUpper, int argc, char **argv)
+{
     try {
         if (cmdUpper == "CONFIGURE")
-            return doConfigure(*sp.get(), argc, argv);
+            return doConfigure(sp, argc, argv);
+        if (cmdUpper == "GROUP")
+            return doGroup(sp, argc, argv);
+        if (cmdUpper == "IMAGE")
+            return doImage(sp, argc, argv);
     }
     catch (const WaitFailed &e)
     {
-        std::cerr << "Serial command failed: " << e.what() << std::endl;
+        std::cerr << sp.m_echoPrefix << "Serial command failed: " << e.what() << std::endl;
         return 1;
     }
     catch (const std::exception &e)
     {
-        std::cerr << "Error " << e.what() << std::endl;
+        std::cerr << sp.m_echoPrefix << "Error " << e.what() << std::endl;
+        return 1;
     }
 
     std::cerr << "Unknown command: " << argv[2] << std::endl;
@@ -187,49 +271,162 @@ int main(int argc, char **argv)
 
 namespace {
 
- void WaitForReady(const std::string &error, SerialWrapper &sp)
-{   // the firmware on the packet thermostat sends "ready>" on its serial port after processing a command
-    static const char SCAN_FOR_READY[] = "ready>";
-    static const unsigned NUM_READ_LOOPS = 10;
-    std::string scan;
-    for (unsigned j = 0; j < NUM_READ_LOOPS; j++)
+ typedef std::chrono::steady_clock Clock;
+
+ unsigned MsecUntil(Clock::time_point deadline)
+{
+     auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+     return remaining > 0 ? static_cast<unsigned>(remaining) : 0;
+}
+
+ void DrainInput(SerialWrapper &sp)
+{   // wait for the serial port to go quiet
+     static const unsigned QUIET_READS = 15;
+     for (unsigned i = 0; i < QUIET_READS; i++)
+     {// this is just a timed delay
+         unsigned char buf[100]; unsigned sze;
+         for (; sp.Read(&buf[0], sizeof(buf), &sze, 100), sze != 0;); // 100msec time out
+     }
+}
+
+/* The firmware on the packet thermostat sends "ready>" on its serial port after processing a command.
+** The port is drained once, when the pipeline is made. After that, unpipelined, each Send sends and
+** returns as soon as its "ready>" arrives. Pipelined, Send streams commands back to back and treats
+** "ready>" as a credit: the commands not yet acknowledged are limited to CMD_BUFLEN bytes. The firmware's cmdbuf holds
+** only the line it is reading; the ones behind it wait in the unit's serial receive buffer, and
+** the limit keeps what is queued there small. The firmware runs a line once CMD_BUFLEN-1 characters
+** are in cmdbuf, so a longer command would be cut there and its CR would run as an empty command
+** with a "ready>" of its own. Send refuses those. */
+class CommandPipeline {
+public:
+    CommandPipeline(SerialWrapper &sp, bool pipelined) : m_sp(sp), m_pipelined(pipelined), m_outstandingBytes(0), m_ready("ready>")
+    {
+        DrainInput(m_sp); // what the unit said before we started isn't an answer to us
+    }
+    void Send(const std::string &cmd)
+    {
+        unsigned sze = static_cast<unsigned>(cmd.size()) + 1; // with its CR
+        if (sze > CMD_BUFLEN - 1)
+        {
+            std::ostringstream oss;
+            oss << "longer than " << CMD_BUFLEN - 2 << " characters: " << cmd;
+            throw WaitFailed(oss.str());
+        }
+        while (!m_outstanding.empty() && (!m_pipelined || m_outstandingBytes + sze > CMD_BUFLEN))
+            WaitForReady();
+        if (!m_sp.Write(cmd + '\r'))
+            throw WaitFailed(cmd);
+        m_outstanding.push_back(cmd);
+        m_outstandingBytes += sze;
+        if (!m_pipelined)
+            WaitForReady();
+    }
+    void Flush()
     {
-        unsigned sizeRead;
-        unsigned char buf[100];
-        if (!sp.Read(&buf[0], sizeof(buf) - 1, &sizeRead)) // 100msec time out
-            continue;
-        for (unsigned i = 0; i < sizeRead; i++)
+        while (!m_outstanding.empty())
+            WaitForReady();
+    }
+    bool pipelined() const { return m_pipelined; }
+    const std::string &Response() const { return m_response; } // text before the "ready>" of the last command retired
+protected:
+    void WaitForReady()
+    {   // consume at least one "ready>" and retire the oldest outstanding commands, one per "ready>"
+        static const unsigned SILENCE_TIMEOUT_MSEC = 1000;
+        auto deadline = Clock::now() + std::chrono::milliseconds(SILENCE_TIMEOUT_MSEC);
+        bool retired = false;
+        unsigned msec;
+        while (!retired && (msec = MsecUntil(deadline)) != 0)
         {
-            char c = (char)buf[i];
-            scan.push_back(isalpha(c) ? tolower(c) : c);
-            std::cout << c;
-            if (scan.find(std::string(SCAN_FOR_READY)) != scan.npos)
+            unsigned sizeRead;
+            unsigned char buf[100];
+            if (!m_sp.Read(&buf[0], sizeof(buf), &sizeRead, msec))
+                break;
+            if (sizeRead != 0) // the timeout is for silence, not for the whole pipeline
+                deadline = Clock::now() + std::chrono::milliseconds(SILENCE_TIMEOUT_MSEC);
+            for (unsigned i = 0; i < sizeRead; i++)
             {
-                std::cout << std::endl;
-                return;
+                char c = (char)buf[i];
+                m_pending.push_back(c);
+                if (c != '\r' && c != '\n')
+                    m_echo.push_back(c);
+                else if (!m_echo.empty())
+                    Echo();
+                if (m_ready.Feed(c))
+                {
+                    Echo();
+                    m_response.swap(m_pending);
+                    m_pending.clear();
+                    if (!m_outstanding.empty())
+                    {
+                        m_outstandingBytes -= static_cast<unsigned>(m_outstanding.front().size()) + 1;
+                        m_outstanding.pop_front();
+                    }
+                    retired = true;
+                }
             }
         }
-        while (scan.size() > sizeof(SCAN_FOR_READY))
-            scan.erase(scan.begin());
+        if (!retired)
+            throw WaitFailed(m_outstanding.front());
     }
-    throw WaitFailed(error);
-}
+    void Echo()
+    {   // a whole line at a time, so the lines of several ports don't mix
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << m_sp.m_echoPrefix << m_echo << std::endl;
+        m_echo.clear();
+    }
+    SerialWrapper &m_sp;
+    const bool m_pipelined;
+    std::deque<std::string> m_outstanding;
+    unsigned m_outstandingBytes;
+    PacketThermostat::PromptMatcher m_ready;
+    std::string m_pending;
+    std::string m_response;
+    std::string m_echo;
+};
 
- void DoCommandAndWait(const std::string &cmd, SerialWrapper&sp)
+ void SendMap(const unsigned char *map, unsigned count, CommandPipeline &sp)
 {
-     for (int i = 0; i < 15; i++)
-     {// this is just a timed delay
-         unsigned char buf[1]; unsigned sze;
-         for (; sp.Read(&buf[0], sizeof(buf), &sze), sze != 0;); // 100msec time out
+     if (sp.pipelined())
+     {   // packed form: 32 entries per command
+         static const unsigned PACKED_ENTRIES = 32;
+         for (unsigned i = 0; i < count; )
+         {
+             std::ostringstream oss;
+             oss << "HVACMAP=0x" << std::hex << i << " :";
+             for (unsigned m = 0; m < PACKED_ENTRIES && i < count; m++)
+                 oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(map[i++]);
+             sp.Send(oss.str());
+         }
+         return;
+     }
+     unsigned i = 0;
+     for (unsigned j = 0; j < count / 8; j++) // spread the map into 8 commands to limit buffer size to what fits
+     {
+         std::ostringstream oss;
+         oss << "HVACMAP=0x" << std::hex << i << " ";
+         for (int m = 7; m >= 0; m -= 1)
+         {
+             oss << std::hex << static_cast<int>(map[i++]);
+             if (m != 0)
+                 oss << " ";
+         }
+         sp.Send(oss.str());
      }
-     sp.Write(cmd + '\r');
-     WaitForReady(cmd, sp);
 }
 
- int doConfigure(SerialWrapper&sp, int argc, char **argv)
+ // every sensor in the HVAC_SETTINGS mask counts the same
+ const char EQUAL_SENSOR_WEIGHTS[] = "HVAC_WEIGHTS 1 1 1 1 1 1 1 1";
+
+ int doConfigure(SerialWrapper &port, int argc, char **argv)
 {
      std::string wireNames = "HV R Y2 G W d Y O x";
+     // The default for this program is to support the O wire reversing valve logic. Command line -B switches to B wire logic.
+     // Locals, because CONFIGURE on several ports runs this on a thread per port
+     uint8_t MASK_O = 1 << BN_X1;
+     uint8_t MASK_B = 0;
      uint32_t sensorMask = 0;
+     bool pipelined = false;
      for (int i = 0; i < argc; i++)
      {   // scan command line for -s
          if (strcmp(argv[i], "-s") == 0)
@@ -247,10 +444,13 @@ namespace {
              MASK_B = 1 << BN_X1;
              MASK_O = 0;
          }
+         else if (strcmp(argv[i], "-P") == 0)
+             pipelined = true;
      }
+     CommandPipeline sp(port, pipelined);
 
     // name the wires
-    DoCommandAndWait(wireNames, sp);
+    sp.Send(wireNames);
 
     uint8_t compressorMask = MASK_Y | MASK_Y2;
     {
@@ -259,18 +459,18 @@ namespace {
         setCompressorMask << "COMPRESSOR=0x";
         setCompressorMask << std::hex << static_cast<int>(compressorMask);
         setCompressorMask << " " << std::dec << COMPRESSOR_HOLD_SECONDS;
-        DoCommandAndWait(setCompressorMask.str(), sp);
+        sp.Send(setCompressorMask.str());
     }
 
     // name the PassThrough mode as PasT
-    DoCommandAndWait("HVAC TYPE=0 MODE=0", sp);
-    DoCommandAndWait("HVAC NAME=PasT", sp);
-    DoCommandAndWait("HVAC COMMIT", sp);
+    sp.Send("HVAC TYPE=0 MODE=0");
+    sp.Send("HVAC NAME=PasT");
+    sp.Send("HVAC COMMIT");
 
     // mapping mode to disable heat pump****************************************************
-    DoCommandAndWait("HVAC TYPE=1 COUNT=2", sp);    // set up a mapping mode 
-    DoCommandAndWait("HVAC TYPE=1 MODE=0", sp); // switch to the newly created mode
-    DoCommandAndWait("HVAC NAME=NoHP", sp); // name the mode NoHP
+    sp.Send("HVAC TYPE=1 COUNT=2");    // set up a mapping mode 
+    sp.Send("HVAC TYPE=1 MODE=0"); // switch to the newly created mode
+    sp.Send("HVAC NAME=NoHP"); // name the mode NoHP
 
     static const int SIGNAL_COMBINATIONS = 1 << NUM_HVAC_INPUT_SIGNALS;
     unsigned char map[SIGNAL_COMBINATIONS];
@@ -289,24 +489,12 @@ namespace {
         }
     }
 
-    unsigned i = 0;
-    for (unsigned j = 0; j < 8; j++) // spread the map into 8 commands to limit buffer size to what fits
-    {
-        std::ostringstream oss;
-        oss << "HVACMAP=0x" << std::hex << i << " ";
-        for (int m = 7; m >= 0; m -= 1)
-        {
-            oss << std::hex << static_cast<int>(map[i++]) ;
-            if (m != 0)
-                oss << " ";
-        }
-        DoCommandAndWait(oss.str(), sp);
-    }
-    DoCommandAndWait("HVAC COMMIT", sp); // into EEPROM on the Packet Thermostat
+    SendMap(map, SIGNAL_COMBINATIONS, sp);
+    sp.Send("HVAC COMMIT"); // into EEPROM on the Packet Thermostat
 
         // mapping mode pass through plus AUX fan output ****************************************************
-    DoCommandAndWait("HVAC TYPE=1 MODE=1", sp); // switch to the newly created mode
-    DoCommandAndWait("HVAC NAME=PasG", sp); // name the mode PasG
+    sp.Send("HVAC TYPE=1 MODE=1"); // switch to the newly created mode
+    sp.Send("HVAC NAME=PasG"); // name the mode PasG
 
     for (unsigned i = 0; i < SIGNAL_COMBINATIONS; i++)
     {
@@ -317,25 +505,13 @@ namespace {
             map[i] |= MAX_AUXFAN;   // turn on aux fan
     }
 
-    i = 0;
-    for (unsigned j = 0; j < 8; j++) // spread the map into 8 commands to limit buffer size to what fits
-    {
-        std::ostringstream oss;
-        oss << "HVACMAP=0x" << std::hex << i << " ";
-        for (int m = 7; m >= 0; m -= 1)
-        {
-            oss << std::hex << static_cast<int>(map[i++]);
-            if (m != 0)
-                oss << " ";
-        }
-        DoCommandAndWait(oss.str(), sp);
-    }
-    DoCommandAndWait("HVAC COMMIT", sp); // into EEPROM on the Packet Thermostat
+    SendMap(map, SIGNAL_COMBINATIONS, sp);
+    sp.Send("HVAC COMMIT"); // into EEPROM on the Packet Thermostat
 
     // HEAT mode
-    DoCommandAndWait("HVAC TYPE=2 COUNT=2", sp);    // set up a mapping mode 
-    DoCommandAndWait("HVAC TYPE=2 MODE=0", sp); // switch to the newly created mode
-    DoCommandAndWait("HVAC NAME=HEAT", sp); // name the mode 
+    sp.Send("HVAC TYPE=2 COUNT=2");    // set up a mapping mode 
+    sp.Send("HVAC TYPE=2 MODE=0"); // switch to the newly created mode
+    sp.Send("HVAC NAME=HEAT"); // name the mode 
 
     {
         std::ostringstream heatSettings;
@@ -363,13 +539,14 @@ namespace {
 
         heatSettings << " " << std::dec << secondsToStage2Heat + secondsToStage3Heat; /// seconds to stage 3
 
-        DoCommandAndWait(heatSettings.str(), sp);
+        sp.Send(heatSettings.str());
+        sp.Send(EQUAL_SENSOR_WEIGHTS);
     }
-    DoCommandAndWait("HVAC COMMIT", sp);
+    sp.Send("HVAC COMMIT");
 
     // wHEAT mode
-    DoCommandAndWait("HVAC TYPE=2 MODE=1", sp); // switch to the newly created mode
-    DoCommandAndWait("HVAC NAME=wHEAT", sp); // name the mode
+    sp.Send("HVAC TYPE=2 MODE=1"); // switch to the newly created mode
+    sp.Send("HVAC NAME=wHEAT"); // name the mode
 
     {
         std::ostringstream heatSettings;
@@ -382,15 +559,16 @@ namespace {
         heatSettings << " " << std::hex << (int)(MASK_W | MASK_DH | MAX_AUXFAN); // heat stage 3 (switch to furnace only
         heatSettings << " " << std::dec << 10; // second stage matches 1, so short timeout
         heatSettings << " " << std::dec << (60 * 20); // stage 2 timeout is ALSO used by thermostat to notice thermometer timeout: 20 minutes
-        DoCommandAndWait(heatSettings.str(), sp);
+        sp.Send(heatSettings.str());
+        sp.Send(EQUAL_SENSOR_WEIGHTS);
     }
 
-    DoCommandAndWait("HVAC COMMIT", sp);
+    sp.Send("HVAC COMMIT");
 
     // COOL mode
-    DoCommandAndWait("HVAC TYPE=3 COUNT=1", sp);    // set up a mapping mode 
-    DoCommandAndWait("HVAC TYPE=3 MODE=0", sp); // switch to the newly created mode
-    DoCommandAndWait("HVAC NAME=COOL", sp); // name the mode
+    sp.Send("HVAC TYPE=3 COUNT=1");    // set up a mapping mode 
+    sp.Send("HVAC TYPE=3 MODE=0"); // switch to the newly created mode
+    sp.Send("HVAC NAME=COOL"); // name the mode
 
     {
         std::ostringstream coolSettings;
@@ -403,7 +581,8 @@ namespace {
         coolSettings << " " << std::hex << (int)(MASK_O | MASK_DH | MASK_Y2 | MASK_Y | MASK_G | MAX_AUXFAN); // cool stage 3 
         coolSettings << " " << std::dec << 1200; // stage 1 timeout. 20 minutes
         coolSettings << " " << std::dec << 9999; // 3 stage matches 2
-        DoCommandAndWait(coolSettings.str(), sp);
+        sp.Send(coolSettings.str());
+        sp.Send(EQUAL_SENSOR_WEIGHTS);
     }
     {
         std::ostringstream dehumidify;
@@ -411,14 +590,14 @@ namespace {
         dehumidify << " " << std::dec << 600; // 60% humidity target
         dehumidify << " " << std::hex << (int)0; // turn ON no bits
         dehumidify << " " << std::hex << (int)(MASK_DH); // turn OFF the DH wire.
-        DoCommandAndWait(dehumidify.str(), sp); // no demudify function.
+        sp.Send(dehumidify.str()); // no demudify function.
     }
 
-    DoCommandAndWait("HVAC COMMIT", sp);
+    sp.Send("HVAC COMMIT");
 
     // Heat mode safety check. Force furnace off if intake temperature exceeds setting
-    DoCommandAndWait("HS T 300", sp); // heat safety timeout 5 minutes. once triggered, off this long
-    DoCommandAndWait("HS C 322", sp); // heat safety temperature 32.2C (about 90F)
+    sp.Send("HS T 300"); // heat safety timeout 5 minutes. once triggered, off this long
+    sp.Send("HS C 322"); // heat safety temperature 32.2C (about 90F)
 
     {
         std::ostringstream safety1;
@@ -430,7 +609,7 @@ namespace {
         safety1 << "HS 1 " << std::hex << static_cast<int>(dontCare) << " " << 
                               std::hex << static_cast<int>(mustMatchMask) << " " <<
                               std::hex << static_cast<int>(toClear);
-        DoCommandAndWait(safety1.str(), sp);
+        sp.Send(safety1.str());
 
         dontCare = ~(MASK_Y | MASK_O | MASK_B); // Y and O or B are what we DO care about.
         mustMatchMask = MASK_Y | MASK_B ; // compressor ON, and reversing valve is HEAT
@@ -438,11 +617,14 @@ namespace {
         safety2 << "HS 2 " << std::hex << static_cast<int>(dontCare) << " " <<
             std::hex << static_cast<int>(mustMatchMask) << " " <<
             std::hex << static_cast<int>(toClear);
-        DoCommandAndWait(safety2.str(), sp);
+        sp.Send(safety2.str());
 
-        DoCommandAndWait("HS 3", sp);
+        sp.Send("HS 3");
     }
 
+    if (sp.pipelined())
+        sp.Send("SE *"); // clear all schedule entries
+    else
     {
         // clear all schedule entries
         const int NUM_SCHEDULE_ENTRIES = 16;
@@ -450,11 +632,203 @@ namespace {
         {
             std::ostringstream oss;
             oss << "SE " << i;
-            DoCommandAndWait(oss.str(), sp);
+            sp.Send(oss.str());
         }
     }
 
+    sp.Send("HVAC TYPE=3 MODE=0"); // MODE= writes the COOL mode's pending COMMIT now
+    sp.Flush();
     return 0;
 }
 
+
+ int doGroup(SerialWrapper &port, int argc, char **argv)
+{    // GRP <sequence> <command> to a group or broadcast node ID. See PacketThermostat.ino
+     static const unsigned RF69_MAX_DATA_LEN = 61;
+     static const unsigned BROADCAST_NODEID = 255;
+     std::string gatewayPrefix = "SendMessageToNode";
+     unsigned repeats = 3;
+     unsigned sequence = static_cast<unsigned>(time(nullptr)) & 0xffffu; // differs from the last run
+     int i = 3;
+     for (; i < argc && argv[i][0] == '-'; i++)
+     {
+         if (i + 1 >= argc)
+             break;
+         if (strcmp(argv[i], "-G") == 0)
+             gatewayPrefix = argv[++i];
+         else if (strcmp(argv[i], "-R") == 0)
+             repeats = static_cast<unsigned>(atoi(argv[++i]));
+         else if (strcmp(argv[i], "-S") == 0)
+             sequence = static_cast<unsigned>(atoi(argv[++i])) & 0xffffu;
+         else
+             break;
+     }
+     if (i + 2 > argc)
+     {
+         std::cerr << "GROUP needs a group id and a command" << std::endl;
+         return 1;
+     }
+     unsigned group = static_cast<unsigned>(atoi(argv[i++]));
+     if (group == 0 || group > BROADCAST_NODEID)
+     {
+         std::cerr << "group id must be 1 through " << BROADCAST_NODEID << std::endl;
+         return 1;
+     }
+     std::ostringstream packet;
+     packet << "GRP " << sequence;
+     for (; i < argc; i++)
+         packet << " " << argv[i];
+     if (packet.str().size() > RF69_MAX_DATA_LEN)
+     {
+         std::cerr << "command does not fit a radio packet: " << packet.str() << std::endl;
+         return 1;
+     }
+
+     CommandPipeline sp(port, false);
+     if (gatewayPrefix.empty())
+         sp.Send(packet.str()); // a thermostat on the serial port. Once is enough
+     else
+     {
+         std::ostringstream oss;
+         oss << gatewayPrefix << " " << group << " " << packet.str();
+         for (unsigned r = 0; r < repeats; r++)
+             sp.Send(oss.str()); // the gateway reports no ACK. That is expected
+     }
+     sp.Flush();
+     return 0;
+}
+
+ /* The ER and EW commands in PacketThermostat.ino. An image file is all E2END + 1 bytes of a unit's EEPROM,
+ ** with 0xff for the radio configuration bytes, which are never sent. It is laid out for the AVR, so it is not
+ ** an image PacketThermostatSim -e can load.
+ ** The image holds the golden unit's wire names, group id, learned recovery rates and recent setpoints
+ ** too. ER alone lists those ranges, and IMAGE WRITE keeps the target unit's own bytes there. */
+ const unsigned EEPROM_SIZE = 1024;
+ const unsigned IMAGE_BLOCK = 16;
+
+ uint16_t CrcUpdate(uint16_t crc, uint8_t b)
+{    // CRC-16/CCITT-FALSE, as EepromImage::crcUpdate
+     crc ^= static_cast<uint16_t>(b) << 8;
+     for (int i = 0; i < 8; i++)
+         crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+     return crc;
+}
+
+ std::string ErReply(const std::string &response)
+{    // the rest of the reply line that starts with "ER ". Verbose firmware also echoes the command
+     std::istringstream lines(response);
+     std::string line;
+     while (std::getline(lines, line))
+     {
+         auto start = line.find_first_not_of("\r");
+         if (start != std::string::npos && line.compare(start, 3, "ER ") == 0)
+             return line.substr(start + 3);
+     }
+     throw WaitFailed("no ER reply");
+}
+
+ void ReadBlock(CommandPipeline &sp, unsigned addr, unsigned count, std::vector<uint8_t> &image)
+{
+     std::ostringstream oss;
+     oss << "ER " << std::hex << addr << " " << std::dec << count;
+     sp.Send(oss.str());
+     sp.Flush();
+     std::istringstream reply(ErReply(sp.Response()));
+     unsigned replyAddr; std::string hex;
+     if (!(reply >> std::hex >> replyAddr >> hex) || replyAddr != addr || hex.size() != 2 * count + 1 || hex[0] != ':')
+         throw WaitFailed(oss.str());
+     for (unsigned i = 0; i < count; i++)
+         image[addr + i] = static_cast<uint8_t>(std::stoul(hex.substr(1 + 2 * i, 2), 0, 16));
+}
+
+ typedef std::vector<std::pair<unsigned, unsigned> > Ranges; // [from, to)
+
+ void ReadImage(CommandPipeline &sp, unsigned &first, std::vector<uint8_t> &image, Ranges &unitRanges)
+{
+     sp.Send("ER");
+     sp.Flush();
+     std::istringstream layout(ErReply(sp.Response()));
+     unsigned end;
+     if (!(layout >> std::hex >> first >> end) || end != EEPROM_SIZE || first >= end)
+         throw WaitFailed("ER");
+     unitRanges.clear();
+     for (unsigned from, to; layout >> from >> to;)
+         if (from < to && to <= end)
+             unitRanges.push_back(std::make_pair(from, to));
+     image.assign(EEPROM_SIZE, 0xff);
+     for (unsigned addr = first; addr < end; addr += IMAGE_BLOCK)
+         ReadBlock(sp, addr, std::min(IMAGE_BLOCK, end - addr), image);
+}
+
+ int doImage(SerialWrapper &port, int argc, char **argv)
+{
+     if (argc < 5)
+     {
+         std::cerr << "IMAGE needs READ or WRITE, and a file" << std::endl;
+         return 1;
+     }
+     std::string op = argv[3];
+     std::transform(op.begin(), op.end(), op.begin(), ::toupper);
+     CommandPipeline sp(port, true); // one command at a time, but without waiting for quiet between them
+     unsigned first;
+     std::vector<uint8_t> current;
+     Ranges unitRanges;
+     ReadImage(sp, first, current, unitRanges);
+     if (op == "READ")
+     {
+         std::ofstream out(argv[4], std::ios::binary);
+         if (!out.write(reinterpret_cast<const char *>(&current[0]), current.size()))
+         {
+             std::cerr << "can't write " << argv[4] << std::endl;
+             return 1;
+         }
+         return 0;
+     }
+     if (op != "WRITE")
+     {
+         std::cerr << "Unknown IMAGE operation: " << argv[3] << std::endl;
+         return 1;
+     }
+     std::vector<uint8_t> wanted(EEPROM_SIZE);
+     std::ifstream in(argv[4], std::ios::binary);
+     if (!in.read(reinterpret_cast<char *>(&wanted[0]), wanted.size()))
+     {
+         std::cerr << "can't read " << EEPROM_SIZE << " bytes from " << argv[4] << std::endl;
+         return 1;
+     }
+     if (unitRanges.empty())
+         std::cerr << "Warning: the unit doesn't list its own EEPROM ranges. Its wire names, group id,"
+             " recovery rates and setpoints are overwritten with the image's" << std::endl;
+     for (auto &r : unitRanges)
+     {   // the unit keeps its own bytes there
+         std::copy(current.begin() + r.first, current.begin() + r.second, wanted.begin() + r.first);
+         std::cout << "Keeping the unit's bytes from " << std::hex << r.first << " to " << r.second
+             << std::dec << std::endl;
+     }
+     unsigned blocksWritten = 0;
+     for (unsigned addr = first; addr < EEPROM_SIZE; addr += IMAGE_BLOCK)
+     {
+         unsigned count = std::min(IMAGE_BLOCK, EEPROM_SIZE - addr);
+         if (std::equal(wanted.begin() + addr, wanted.begin() + addr + count, current.begin() + addr))
+             continue;
+         std::ostringstream hex;
+         uint16_t crc = CrcUpdate(CrcUpdate(0xffff, addr & 0xff), addr >> 8);
+         for (unsigned i = 0; i < count; i++)
+         {
+             crc = CrcUpdate(crc, wanted[addr + i]);
+             hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(wanted[addr + i]);
+         }
+         std::ostringstream oss;
+         oss << "EW " << std::hex << addr << " " << crc << " :" << hex.str();
+         sp.Send(oss.str());
+         ReadBlock(sp, addr, count, current); // and check it took
+         if (!std::equal(wanted.begin() + addr, wanted.begin() + addr + count, current.begin() + addr))
+             throw WaitFailed(oss.str());
+         blocksWritten += 1;
+     }
+     std::cout << "Blocks written: " << blocksWritten << std::endl;
+     if (blocksWritten != 0)
+         port.Write("EW *\r"); // restarts the unit, so it sends no ready>
+     return 0;
+}
 }
\ No newline at end of file
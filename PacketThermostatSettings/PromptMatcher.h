@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ctype.h>
+namespace PacketThermostat {
+/* Case insensitive search for a prompt in a byte stream, one byte at a time. 
+** Knuth-Morris-Pratt, so the stream is never rescanned and nothing is buffered. */
+class PromptMatcher {
+public:
+    explicit PromptMatcher(const char *prompt) : m_prompt(prompt), m_matched(0), m_fallback(m_prompt.size(), 0)
+    {
+        for (auto &c : m_prompt)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        // m_fallback[i] is the length of the longest proper prefix of m_prompt that is also a suffix of m_prompt[0..i]
+        for (size_t i = 1, k = 0; i < m_prompt.size(); i++)
+        {
+            while (k > 0 && m_prompt[i] != m_prompt[k])
+                k = m_fallback[k - 1];
+            if (m_prompt[i] == m_prompt[k])
+                k += 1;
+            m_fallback[i] = k;
+        }
+    }
+    bool Feed(char c)
+    {   // true when c completes the prompt
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        while (m_matched > 0 && c != m_prompt[m_matched])
+            m_matched = m_fallback[m_matched - 1];
+        if (c == m_prompt[m_matched])
+            m_matched += 1;
+        if (m_matched < m_prompt.size())
+            return false;
+        m_matched = 0;
+        return true;
+    }
+private:
+    std::string m_prompt;
+    size_t m_matched;
+    std::vector<size_t> m_fallback;
+};
+}
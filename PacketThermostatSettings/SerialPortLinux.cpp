@@ -3,6 +3,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 
 #include "SerialPortLinux.h"
@@ -24,7 +26,7 @@ int SerialPort::OpenCommPort()
 {
     if (m_CommPortFD >= 0)
         ::close(m_CommPortFD);
-    m_CommPortFD = ::open(m_commPortName.c_str(), O_RDWR | O_NOCTTY);
+    m_CommPortFD = ::open(m_commPortName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
 
     if (m_CommPortFD == -1)
         return -1;
@@ -72,11 +74,9 @@ int SerialPort::OpenCommPort()
 	newtio.c_oflag = ONLRET | ONOCR;
 	newtio.c_lflag = 0;
 	newtio.c_cc[VMIN] = 0;
-	newtio.c_cc[VTIME] = 1;
-    /*   MIN == 0; TIME > 0: TIME specifies the limit for a timer in tenths of a second. 
-    The timer is started when read(2) is called. read(2) returns either when at least 
-    one byte of data is available, or when the timer expires. If the timer expires 
-    without any input becoming available, read(2) returns 0.     */
+	newtio.c_cc[VTIME] = 0;
+    /* The port is O_NONBLOCK and read(2) returns whatever is available. Read and Write
+    ** use poll(2) for their deadlines, so they return as soon as the port is ready */
 	tcsetattr(m_CommPortFD,TCSANOW,&newtio);
     int flag;
     flag = TIOCM_RTS;
@@ -86,18 +86,62 @@ int SerialPort::OpenCommPort()
     return 0;
 }
 
-bool SerialPort::Read(unsigned char *rbuf, unsigned sizeToRead, unsigned *nrr)
+namespace {
+    enum WaitResult { WAIT_READY, WAIT_TIMEOUT, WAIT_ERROR };
+
+    WaitResult WaitFor(int fd, short events, int timeoutMsec)
+    {   // a hangup (the device was unplugged) is an error, not a timeout
+        struct pollfd pfd = { fd, events, 0 };
+        int res;
+        while ((res = ::poll(&pfd, 1, timeoutMsec)) < 0 && errno == EINTR)
+            ;
+        if (res < 0)
+            return WAIT_ERROR;
+        if (res == 0)
+            return WAIT_TIMEOUT;
+        if ((pfd.revents & events) != 0)
+            return WAIT_READY; // read what is left before reporting any hangup
+        return WAIT_ERROR; // POLLHUP, POLLERR or POLLNVAL
+    }
+    const int WRITE_TIMEOUT_MSEC = 2000;
+}
+
+bool SerialPort::Read(unsigned char *rbuf, unsigned sizeToRead, unsigned *nrr, unsigned timeoutMsec)
 {
-    
+    *nrr = 0;
+    switch (WaitFor(m_CommPortFD, POLLIN, static_cast<int>(timeoutMsec)))
+    {
+    case WAIT_TIMEOUT:
+        return true; // timed out with nothing read
+    case WAIT_ERROR:
+        return false;
+    default:
+        break;
+    }
     int res = ::read(m_CommPortFD, rbuf, sizeToRead);
-    if (res >= 0)
+    if (res > 0)
     	*nrr = res;
-    return res >= 0;  // true is success
+    else if (res < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+    return res > 0;  // true is success. Readable with nothing to read is a hangup
 }
 
 bool SerialPort::Write(const unsigned char *v, unsigned s)
-{
-    int res = ::write(m_CommPortFD, v, s);
+{   // all of it, or false
+    while (s > 0)
+    {
+        int res = ::write(m_CommPortFD, v, s);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN || WaitFor(m_CommPortFD, POLLOUT, WRITE_TIMEOUT_MSEC) != WAIT_READY)
+                return false;
+            continue;
+        }
+        v += res;
+        s -= res;
+    }
     return true;
 }
 }
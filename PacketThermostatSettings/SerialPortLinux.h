@@ -7,10 +7,12 @@ public:
         SerialPort(const char *commPortName, unsigned baudrate);
         ~SerialPort();
         int OpenCommPort();
-        bool Read(unsigned char *, unsigned, unsigned *);
+        // Returns as soon as any bytes arrive, or with zero bytes after timeoutMsec
+        bool Read(unsigned char *, unsigned, unsigned *, unsigned timeoutMsec = 100);
         bool Write(const unsigned char *, unsigned);
         bool Write(const std::string &s) { return Write(reinterpret_cast<const unsigned char *>(s.c_str()), static_cast<unsigned>(s.size()));}
         const std::string &commPortName()const {return m_commPortName;}
+        int fd() const { return m_CommPortFD; } // for a caller that polls several ports at once
 protected:
         const std::string m_commPortName;
         int  m_CommPortFD;
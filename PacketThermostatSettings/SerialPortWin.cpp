@@ -3,13 +3,17 @@ namespace PacketThermostat {
 SerialPort::SerialPort(const char *commPortName, unsigned baudrate) : 
     m_commPortName(commPortName),
     m_BaudRate(baudrate),
-    m_CommPort(INVALID_HANDLE_VALUE)
+    m_CommPort(INVALID_HANDLE_VALUE),
+    m_ReadEvent(::CreateEvent(0, TRUE, FALSE, 0)),
+    m_WriteEvent(::CreateEvent(0, TRUE, FALSE, 0))
 {}
 
 SerialPort::~SerialPort()
 {
     if (m_CommPort != INVALID_HANDLE_VALUE)
         ::CloseHandle(m_CommPort);
+    ::CloseHandle(m_ReadEvent);
+    ::CloseHandle(m_WriteEvent);
 }
 
 int SerialPort::OpenCommPort()
@@ -20,7 +24,7 @@ int SerialPort::OpenCommPort()
     m_CommPort = CreateFileA(fname.c_str(),
                     GENERIC_READ|GENERIC_WRITE,
                     0, 0, OPEN_EXISTING, 
-                    FILE_ATTRIBUTE_NORMAL, 0);
+                    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, 0);
     if (m_CommPort == INVALID_HANDLE_VALUE)
         return -1;
 
@@ -46,9 +50,11 @@ int SerialPort::OpenCommPort()
         return -3;
     COMMTIMEOUTS CommTimeOuts;
     memset(&CommTimeOuts, 0, sizeof(CommTimeOuts));
-    CommTimeOuts.ReadIntervalTimeout = 0; // 100x as long as a char
-    CommTimeOuts.ReadTotalTimeoutMultiplier = 0;
-    CommTimeOuts.ReadTotalTimeoutConstant = 100;    //allowed pause for response
+    // MAXDWORD, MAXDWORD and a constant: ReadFile completes as soon as any byte is available.
+    // Read waits on the overlapped event for its own deadline, so the constant is just a backstop
+    CommTimeOuts.ReadIntervalTimeout = MAXDWORD;
+    CommTimeOuts.ReadTotalTimeoutMultiplier = MAXDWORD;
+    CommTimeOuts.ReadTotalTimeoutConstant = 60000;
 	if (SetCommTimeouts(m_CommPort, &CommTimeOuts) == 0)
         return -4;
 
@@ -57,19 +63,47 @@ int SerialPort::OpenCommPort()
     return 0;
 }
 
-bool SerialPort::Read(unsigned char *rbuf, unsigned sizeToRead, unsigned *nrr)
+bool SerialPort::Read(unsigned char *rbuf, unsigned sizeToRead, unsigned *nrr, unsigned timeoutMsec)
 {
-    DWORD nr;
-    BOOL res = ::ReadFile(m_CommPort, rbuf, sizeToRead, &nr, 0);
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = m_ReadEvent;
+    ::ResetEvent(m_ReadEvent);
+    DWORD nr = 0;
+    *nrr = 0;
+    if (!::ReadFile(m_CommPort, rbuf, sizeToRead, &nr, &ov))
+    {
+        if (::GetLastError() != ERROR_IO_PENDING)
+            return false;
+        if (::WaitForSingleObject(m_ReadEvent, timeoutMsec) != WAIT_OBJECT_0)
+            ::CancelIo(m_CommPort); // completes the read with whatever it has, likely nothing
+        if (!::GetOverlappedResult(m_CommPort, &ov, &nr, TRUE) && ::GetLastError() != ERROR_OPERATION_ABORTED)
+            return false;
+    }
     *nrr = nr;
-    return res ? true : false;  // true is success
+    return true;  // true is success
 }
 
 bool SerialPort::Write(const unsigned char *v, unsigned s)
-{
-    DWORD nw;
-    if ((::WriteFile(m_CommPort, (void *)v, s, &nw, 0)==0)
-        || (nw != s)) return false;
+{   // all of it, or false
+    while (s > 0)
+    {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.hEvent = m_WriteEvent;
+        ::ResetEvent(m_WriteEvent);
+        DWORD nw = 0;
+        if (!::WriteFile(m_CommPort, (void *)v, s, &nw, &ov))
+        {
+            if (::GetLastError() != ERROR_IO_PENDING ||
+                !::GetOverlappedResult(m_CommPort, &ov, &nw, TRUE))
+                return false;
+        }
+        if (nw == 0)
+            return false;
+        v += nw;
+        s -= nw;
+    }
     return true;
 }
 }
\ No newline at end of file
@@ -9,7 +9,8 @@ public:
         SerialPort(const char *commPortName, unsigned baudrate = 19200);
         ~SerialPort();
         int OpenCommPort();
-        bool Read(unsigned char *, unsigned, unsigned *);
+        // Returns as soon as any bytes arrive, or with zero bytes after timeoutMsec
+        bool Read(unsigned char *, unsigned, unsigned *, unsigned timeoutMsec = 100);
         bool Write(const unsigned char *, unsigned);
         bool Write(const std::string &s) { return Write(reinterpret_cast<const unsigned char *>(s.c_str()), static_cast<unsigned>(s.size()));}
         const std::string &commPortName()const {return m_commPortName;}
@@ -17,5 +18,7 @@ protected:
         const std::string m_commPortName;
         const unsigned m_BaudRate;
         HANDLE  m_CommPort;
+        HANDLE  m_ReadEvent; // overlapped I/O completion
+        HANDLE  m_WriteEvent;
 };
 }
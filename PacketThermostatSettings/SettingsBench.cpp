@@ -0,0 +1,395 @@
+/* Measure PacketThermostatSettings against an emulated thermostat on a pseudo-terminal.
+**
+**      SettingsBench [-d <msec per command>] [-q] [<path to PacketThermostatSettings>]
+**
+** The emulator holds the master side of a pty and plays the firmware's side of the serial protocol.
+** Like the firmware, it has room for only CMD_BUFLEN bytes that it has not yet answered. One thread
+** receives bytes into that buffer, and a byte that arrives when it is full is dropped and counted
+** as an overrun. Another thread takes one command at a time from the buffer, up to its CR, spends the
+** -d time processing it (default 10 msec), answers it with "ready>", and only then frees its bytes.
+** ER and EW work on an emulated EEPROM as they do in PacketThermostat.ino, CRC check included, and ER
+** alone lists two per-unit ranges that IMAGE WRITE must leave alone.
+** Nothing else is parsed. The tool under test is run as a child process on the slave side, once per
+** scenario, and the emulator reports for each:
+**      wall time, commands, commands per second, bytes sent to the thermostat
+** and overruns. Anything but zero there means the pipelining sends more than the firmware can hold,
+** and would lose commands on a real unit, so the scenario fails.
+** After each IMAGE WRITE the emulated EEPROM must match the file outside the per-unit ranges, and
+** match what it had before inside them. Writing the same file again must send no EW.
+** The last scenario runs CONFIGURE on two emulated units at once, and its counts are the sum of both.
+**
+** -q skips the unpipelined CONFIGURE.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/wait.h>
+
+namespace PacketThermostat {
+namespace {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned CMD_BUFLEN = 80;     // must match PacketThermostat.ino
+    const unsigned EEPROM_SIZE = 1024;
+    const unsigned IMAGE_FIRST = 64;    // stands in for RadioConfiguration's share of EEPROM
+    const unsigned WIRE_NAMES_END = IMAGE_FIRST + 16;   // the per-unit ranges ER lists
+    const unsigned SETPOINT_RING_START = EEPROM_SIZE - 96;
+    const unsigned MAX_SERIAL_BLOCK = 32;
+
+    uint16_t CrcUpdate(uint16_t crc, uint8_t b)
+    {   // CRC-16/CCITT-FALSE, as EepromImage::crcUpdate
+        crc ^= static_cast<uint16_t>(b) << 8;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        return crc;
+    }
+
+    struct Counters {
+        unsigned commands;
+        unsigned long bytes;
+        unsigned overruns;
+        unsigned blocksWritten;
+    };
+
+    class Emulator {
+    public:
+        Emulator(unsigned msecPerCommand) : m_master(-1), m_slave(-1), m_msecPerCommand(msecPerCommand), m_stop(false), m_lineEnds(0)
+        {
+            memset(&m_counters, 0, sizeof(m_counters));
+            m_eeprom.assign(EEPROM_SIZE, 0xff);
+        }
+        ~Emulator()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_lineReady.notify_all();
+            if (m_thread.joinable())
+                m_thread.join();
+            if (m_processThread.joinable())
+                m_processThread.join();
+            if (m_slave >= 0)
+                ::close(m_slave);
+            if (m_master >= 0)
+                ::close(m_master);
+        }
+        bool Open();
+        const std::string &SlavePath() const { return m_slavePath; }
+        void WaitIdle()
+        {   // for the last commands of a tool that exits without waiting for their answers
+            for (int i = 0; i < 100; i++)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (m_lineEnds == 0)
+                        return;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        Counters Take()
+        {   // and start counting the next scenario from zero
+            std::lock_guard<std::mutex> lock(m_mutex);
+            Counters ret = m_counters;
+            memset(&m_counters, 0, sizeof(m_counters));
+            return ret;
+        }
+        std::vector<uint8_t> Eeprom()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_eeprom;
+        }
+    private:
+        void Run();
+        void ProcessCommands();
+        std::string Process(const std::string &cmd);
+
+        int m_master;
+        int m_slave; // held open so the master never sees a hangup between scenarios
+        std::string m_slavePath;
+        const unsigned m_msecPerCommand;
+        std::atomic<bool> m_stop;
+        std::thread m_thread;        // receives
+        std::thread m_processThread; // answers
+        std::mutex m_mutex;
+        std::condition_variable m_lineReady;
+        Counters m_counters;
+        std::deque<char> m_buffer; // received and not yet answered. Never more than CMD_BUFLEN
+        unsigned m_lineEnds;        // CRs and LFs in m_buffer
+        std::vector<uint8_t> m_eeprom;
+    };
+
+    bool Emulator::Open()
+    {
+        m_master = ::posix_openpt(O_RDWR | O_NOCTTY);
+        if (m_master < 0 || ::grantpt(m_master) < 0 || ::unlockpt(m_master) < 0)
+            return false;
+        const char *name = ::ptsname(m_master);
+        if (!name)
+            return false;
+        m_slavePath = name;
+        m_slave = ::open(name, O_RDWR | O_NOCTTY);
+        if (m_slave < 0)
+            return false;
+        struct termios raw;
+        ::tcgetattr(m_slave, &raw);
+        ::cfmakeraw(&raw); // no echo, no CR translation, before the tool sets its own
+        ::tcsetattr(m_slave, TCSANOW, &raw);
+        m_thread = std::thread(&Emulator::Run, this);
+        m_processThread = std::thread(&Emulator::ProcessCommands, this);
+        return true;
+    }
+
+    void Emulator::Run()
+    {
+        while (!m_stop)
+        {
+            struct pollfd pfd = { m_master, POLLIN, 0 };
+            if (::poll(&pfd, 1, 50) <= 0)
+                continue;
+            char buf[256];
+            auto n = ::read(m_master, buf, sizeof(buf));
+            if (n <= 0)
+                continue;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_counters.bytes += n;
+            for (ssize_t i = 0; i < n; i++)
+            {
+                if (m_buffer.size() >= CMD_BUFLEN)
+                {   // the firmware would lose this byte
+                    m_counters.overruns += 1;
+                    continue;
+                }
+                m_buffer.push_back(buf[i]);
+                if (buf[i] == '\r' || buf[i] == '\n')
+                {
+                    m_lineEnds += 1;
+                    m_lineReady.notify_one();
+                }
+            }
+        }
+    }
+
+    void Emulator::ProcessCommands()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;)
+        {
+            m_lineReady.wait(lock, [this] { return m_stop || m_lineEnds != 0; });
+            if (m_stop)
+                return;
+            std::string line;
+            size_t used = 0;
+            while (m_buffer[used] != '\r' && m_buffer[used] != '\n')
+                line.push_back(m_buffer[used++]);
+            used += 1;
+            lock.unlock(); // bytes keep arriving while the command is processed
+            if (m_msecPerCommand != 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(m_msecPerCommand));
+            lock.lock();
+            std::string reply = Process(line) + "ready>\r\n";
+            m_counters.commands += 1;
+            m_buffer.erase(m_buffer.begin(), m_buffer.begin() + used);
+            m_lineEnds -= 1;
+            lock.unlock();
+            if (::write(m_master, reply.c_str(), reply.size()) < 0)
+                std::cerr << "emulator write failed" << std::endl;
+            lock.lock();
+        }
+    }
+
+    std::string Emulator::Process(const std::string &cmd)
+    {   // the text the firmware prints before its ready>
+        std::ostringstream oss;
+        oss << std::uppercase << std::hex;
+        if (cmd == "ER")
+            oss << "ER " << IMAGE_FIRST << " " << EEPROM_SIZE << " " << IMAGE_FIRST << " " << WIRE_NAMES_END
+                << " " << SETPOINT_RING_START << " " << EEPROM_SIZE << "\r\n"; // wire names and setpoint ring
+        else if (cmd.compare(0, 3, "ER ") == 0)
+        {
+            std::istringstream in(cmd.substr(3));
+            unsigned addr = 0, count = MAX_SERIAL_BLOCK;
+            in >> std::hex >> addr >> std::dec >> count;
+            if (addr < IMAGE_FIRST)
+                addr = IMAGE_FIRST;
+            if (count > MAX_SERIAL_BLOCK)
+                count = MAX_SERIAL_BLOCK;
+            if (addr >= EEPROM_SIZE)
+                count = 0;
+            else if (count > EEPROM_SIZE - addr)
+                count = EEPROM_SIZE - addr;
+            oss << "ER " << addr << " :";
+            for (unsigned i = 0; i < count; i++)
+                oss << std::setw(2) << std::setfill('0') << static_cast<int>(m_eeprom[addr + i]);
+            oss << "\r\n";
+        }
+        else if (cmd.compare(0, 3, "EW ") == 0 && cmd != "EW *")
+        {
+            std::istringstream in(cmd.substr(3));
+            unsigned addr, crc; std::string hex;
+            if (in >> std::hex >> addr >> crc >> hex && hex.size() > 1 && hex[0] == ':')
+            {
+                std::vector<uint8_t> bytes;
+                uint16_t check = CrcUpdate(CrcUpdate(0xffff, addr & 0xff), addr >> 8);
+                for (size_t i = 1; i + 1 < hex.size(); i += 2)
+                {
+                    bytes.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), 0, 16)));
+                    check = CrcUpdate(check, bytes.back());
+                }
+                if (check == crc && addr >= IMAGE_FIRST && addr + bytes.size() <= EEPROM_SIZE)
+                {
+                    std::copy(bytes.begin(), bytes.end(), m_eeprom.begin() + addr);
+                    m_counters.blocksWritten += 1;
+                }
+            }
+        }
+        return oss.str();
+    }
+
+    int RunTool(const std::string &tool, const std::vector<std::string> &args)
+    {   // returns its exit status. Its chatter goes to /dev/null
+        pid_t pid = ::fork();
+        if (pid < 0)
+            return -1;
+        if (pid == 0)
+        {
+            int devnull = ::open("/dev/null", O_WRONLY);
+            if (devnull >= 0)
+                ::dup2(devnull, STDOUT_FILENO);
+            std::vector<char *> argv;
+            argv.push_back(const_cast<char *>(tool.c_str()));
+            for (auto &a : args)
+                argv.push_back(const_cast<char *>(a.c_str()));
+            argv.push_back(0);
+            ::execv(tool.c_str(), &argv[0]);
+            _exit(127);
+        }
+        int status;
+        if (::waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+            return -1;
+        return WEXITSTATUS(status);
+    }
+
+    bool Scenario(const std::vector<Emulator *> &emulators, const std::string &tool, const std::string &name, const std::vector<std::string> &args,
+        int blocksExpected = -1) // -1 for any number of EW
+    {
+        for (auto e : emulators)
+            e->Take();
+        auto start = Clock::now();
+        int status = RunTool(tool, args);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        for (auto e : emulators)
+            e->WaitIdle();
+        Counters c;
+        memset(&c, 0, sizeof(c));
+        for (auto e : emulators)
+        {
+            Counters one = e->Take();
+            c.commands += one.commands;
+            c.bytes += one.bytes;
+            c.overruns += one.overruns;
+            c.blocksWritten += one.blocksWritten;
+        }
+        std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+            << std::setw(9) << std::setprecision(2) << seconds << " s"
+            << std::setw(7) << c.commands << " cmds"
+            << std::setw(9) << std::setprecision(1) << (seconds > 0 ? c.commands / seconds : 0) << " cmds/s"
+            << std::setw(8) << c.bytes << " bytes"
+            << std::setw(5) << c.blocksWritten << " EW"
+            << std::setw(5) << c.overruns << " overruns";
+        bool blocksOK = blocksExpected < 0 || c.blocksWritten == static_cast<unsigned>(blocksExpected);
+        if (status != 0)
+            std::cout << "  FAILED exit " << status;
+        else if (!blocksOK)
+            std::cout << "  FAILED wanted " << blocksExpected << " EW";
+        std::cout << std::endl;
+        return status == 0 && c.overruns == 0 && blocksOK;
+    }
+
+    bool CheckImageWritten(Emulator &emulator, const std::vector<uint8_t> &before, const std::vector<uint8_t> &image)
+    {   // the unit's EEPROM is the image's, except below IMAGE_FIRST and in the per-unit ranges, which keep what they had
+        std::vector<uint8_t> after = emulator.Eeprom();
+        for (unsigned addr = 0; addr < EEPROM_SIZE; addr++)
+        {
+            bool unitsOwn = addr < WIRE_NAMES_END || addr >= SETPOINT_RING_START;
+            if (after[addr] != (unitsOwn ? before[addr] : image[addr]))
+            {
+                std::cout << "IMAGE WRITE FAILED: EEPROM at " << std::hex << addr << " is " << static_cast<int>(after[addr])
+                    << std::dec << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    using namespace PacketThermostat;
+    unsigned msecPerCommand = 10;
+    bool quick = false;
+    std::string tool = "./PacketThermostatSettings";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            msecPerCommand = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0)
+            quick = true;
+        else if (argv[i][0] != '-')
+            tool = argv[i];
+        else
+        {
+            std::cerr << "usage: SettingsBench [-d <msec per command>] [-q] [<path to PacketThermostatSettings>]" << std::endl;
+            return 1;
+        }
+    }
+
+    Emulator emulator(msecPerCommand);
+    Emulator second(msecPerCommand);
+    if (!emulator.Open() || !second.Open())
+    {
+        std::cerr << "can't open a pseudo-terminal" << std::endl;
+        return 1;
+    }
+    const std::string &port = emulator.SlavePath();
+    std::string image = "/tmp/SettingsBench." + std::to_string(getpid()) + ".img";
+
+    bool ok = true;
+    if (!quick)
+        ok &= Scenario({ &emulator }, tool, "CONFIGURE", { port, "CONFIGURE", "-s", "3", "-s", "5" });
+    ok &= Scenario({ &emulator }, tool, "CONFIGURE -P", { port, "CONFIGURE", "-P", "-s", "3", "-s", "5" });
+    ok &= Scenario({ &emulator }, tool, "IMAGE READ", { port, "IMAGE", "READ", image });
+    std::vector<uint8_t> bytes(EEPROM_SIZE);
+    {   // every EW block differs, then none do
+        for (unsigned i = 0; i < bytes.size(); i++)
+            bytes[i] = static_cast<uint8_t>(i * 7);
+        std::ofstream out(image, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(&bytes[0]), bytes.size());
+    }
+    std::vector<uint8_t> before = emulator.Eeprom();
+    ok &= Scenario({ &emulator }, tool, "IMAGE WRITE changed", { port, "IMAGE", "WRITE", image });
+    ok &= CheckImageWritten(emulator, before, bytes);
+    ok &= Scenario({ &emulator }, tool, "IMAGE WRITE same", { port, "IMAGE", "WRITE", image }, 0);
+    ok &= CheckImageWritten(emulator, before, bytes);
+    ok &= Scenario({ &emulator, &second }, tool, "CONFIGURE 2 ports", { port + "," + second.SlavePath(), "CONFIGURE", "-s", "3", "-s", "5" });
+    ::unlink(image.c_str());
+    return ok ? 0 : 1;
+}
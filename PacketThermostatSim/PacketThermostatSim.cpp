@@ -0,0 +1,408 @@
+/* Command line application that runs the Packet Thermostat's HVAC logic natively against recorded traces.
+**
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this packet thermostat software and associated documentation files
+(the "Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to permit
+persons to whom the Software is furnished to do so, subject to the following
+conditions:
+
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/*
+** HVAC.cpp and CommandTokens.cpp are compiled unchanged against the shims in shim/. millis() is a virtual
+** clock that this program advances, so a day of trace replays in well under a second.
+**
+** A trace is a text file with one event per line, in time order. Blank lines and lines starting with # are ignored.
+**      <msec> CMD <command>            a command as if typed on the Serial port. e.g. 0 CMD HVAC TYPE=2 COUNT=1
+**      <msec> PKT <senderid> <text>    a radio packet from a thermometer. e.g. 60000 PKT 3 C:1769, B:198, T:+20.58 R:45.46
+**      <msec> IN <hex>                 the thermostat input wires, as the sketch's InputRegister
+**
+** The sketch's Furnace namespace drives SPI and the W failsafe relay, so it is not compiled here. Instead
+** Furnace below keeps the parts of its logic that decide the outputs: the masking and the compressor short
+** cycle guard.
+*/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "ThermostatCommon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Sim {
+    unsigned long nowMsec;
+    bool verbose;
+}
+SimSerial Serial;
+EEPROMClass EEPROM;
+
+/* The sketch's own settings come first in EEPROM, and 64 bytes stand in for them. A unit's HVAC settings
+** start further up, and the AVR does not pad their structs as the host compiler does, so -e takes only an
+** image that -w wrote, never one from PacketThermostatSettings IMAGE READ. */
+const int HVAC_EEPROM_START = 64;
+
+namespace {
+    // command line settings
+    uint8_t compressorMask = (1 << BN_X2) | (1 << BN_Z2); // -c. Y and Y2 as PacketThermostatSettings wires them
+    unsigned compressorHoldSeconds = 0; // -h. zero models the sketch running without its short cycle guard
+    unsigned shortCycleSeconds = 5 * 60; // -short. compressor restarts sooner than this count as short cycles
+    unsigned loopMsec = 100; // -step. how often hvac->loop runs between events
+    unsigned tailSeconds = 0; // -tail. keep running after the last event
+
+    struct CallCost {
+        const char *name;
+        unsigned long count;
+        double totalNsec;
+        double maxNsec;
+    };
+    enum { COST_LOOP, COST_COMMAND, COST_INPUTS, NUMBER_OF_COSTS };
+    CallCost costs[NUMBER_OF_COSTS] = { {"hvac->loop"}, {"hvac->ProcessCommand"}, {"hvac->OnInputsChanged"} };
+
+    struct CostScope { // times the rest of the enclosing block
+        typedef std::chrono::steady_clock Clock;
+        CostScope(int w) : which(w), start(Clock::now()) {}
+        ~CostScope()
+        {
+            double nsec = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            auto &c = costs[which];
+            c.count += 1;
+            c.totalNsec += nsec;
+            if (nsec > c.maxNsec)
+                c.maxNsec = nsec;
+        }
+        int which;
+        Clock::time_point start;
+    };
+
+    struct OutputStats {
+        unsigned long turnedOn[NUMBER_OF_SIGNALS];
+        unsigned long msecOn[NUMBER_OF_SIGNALS];
+        unsigned long onSince[NUMBER_OF_SIGNALS];
+        unsigned long compressorStarts;
+        unsigned long compressorShortCycles;
+        unsigned long compressorBlocked; // output writes the hold guard masked
+        unsigned long compressorOffAt;
+        bool compressorHasRun;
+    } outputStats;
+
+    struct ComfortStats {
+        double absErrorCx10Msec;
+        double errorCx10Msec;
+        unsigned long msec;
+        bool heardSensor; // no comfort error until there is an actual temperature
+    } comfort;
+
+    uint8_t OutputRegister;
+    uint8_t InputRegister;
+    bool InputsToHvacFlag;
+
+    void recordOutputs(uint8_t mask)
+    {
+        const uint8_t changed = mask ^ OutputRegister;
+        for (int i = 0; i < NUMBER_OF_SIGNALS; i++)
+        {
+            if ((changed & (1 << i)) == 0)
+                continue;
+            if (mask & (1 << i))
+            {
+                outputStats.turnedOn[i] += 1;
+                outputStats.onSince[i] = Sim::nowMsec;
+            }
+            else
+                outputStats.msecOn[i] += Sim::nowMsec - outputStats.onSince[i];
+        }
+        bool compressorWasOn = (OutputRegister & compressorMask) != 0;
+        bool compressorIsOn = (mask & compressorMask) != 0;
+        if (!compressorWasOn && compressorIsOn)
+        {
+            outputStats.compressorStarts += 1;
+            if (outputStats.compressorHasRun && Sim::nowMsec - outputStats.compressorOffAt < 1000ul * shortCycleSeconds)
+                outputStats.compressorShortCycles += 1;
+        }
+        else if (compressorWasOn && !compressorIsOn)
+        {
+            outputStats.compressorOffAt = Sim::nowMsec;
+            outputStats.compressorHasRun = true;
+        }
+        OutputRegister = mask;
+    }
+}
+
+namespace Furnace {
+    uint8_t LastOutputWrite;
+    bool CompressorOffTimeActive;
+    unsigned long CompressorOffStartTime;
+
+    void UpdateOutputs(uint8_t mask)
+    {
+        mask &= OUTPUT_SIGNAL_MASK;
+        LastOutputWrite = mask;
+        if (compressorHoldSeconds != 0)
+        {   // same as the sketch's short cycle guard
+            if (!CompressorOffTimeActive &&
+                (OutputRegister & compressorMask) != 0 && (mask & compressorMask) == 0)
+            {
+                CompressorOffTimeActive = true;
+                CompressorOffStartTime = millis();
+            }
+            if (CompressorOffTimeActive)
+            {
+                if (mask & compressorMask)
+                    outputStats.compressorBlocked += 1;
+                mask &= ~compressorMask;
+            }
+        }
+        recordOutputs(mask);
+    }
+
+    void SetOutputBits(uint8_t mask)
+    {
+        mask |= LastOutputWrite;
+        UpdateOutputs(mask);
+    }
+
+    void ClearOutputBits(uint8_t mask)
+    {
+        UpdateOutputs(LastOutputWrite & ~mask);
+    }
+
+    void loop(unsigned long now)
+    {
+        if (CompressorOffTimeActive && now - CompressorOffStartTime > 1000ul * compressorHoldSeconds)
+        {
+            CompressorOffTimeActive = false;
+            SetOutputBits();
+        }
+    }
+}
+
+namespace {
+    const unsigned RADIO_DATA_LEN = 61; // RF69_MAX_DATA_LEN. The sketch views only the bytes received
+
+    void routeCommand(const std::string &text, uint8_t senderid, bool isPacket)
+    {   // the HVAC part of the sketch's routeCommand
+        char buf[RADIO_DATA_LEN + 1];
+        strncpy(buf, text.c_str(), RADIO_DATA_LEN);
+        buf[RADIO_DATA_LEN] = 0;
+        auto cmd = viewCommand(buf, static_cast<uint8_t>(strlen(buf)), !isPacket);
+        if (cmd.token == CMD_NONE)
+            return;
+        bool accepted;
+        {
+            CostScope cost(COST_COMMAND);
+            accepted = hvac->ProcessCommand(cmd, senderid);
+        }
+        if (accepted)
+            InputsToHvacFlag = true;
+        if (accepted && isPacket)
+            comfort.heardSensor = true;
+        if (!accepted && !isPacket)
+            std::cerr << "t=" << Sim::nowMsec << " command not accepted: " << text << std::endl;
+    }
+
+    void inputsToHvac(uint8_t previous)
+    {
+        CostScope cost(COST_INPUTS);
+        hvac->OnInputsChanged(InputRegister, previous);
+        Furnace::SetOutputBits();
+    }
+
+    void step(unsigned long dt)
+    {   // one pass of the sketch's loop(), as far as HVAC is concerned
+        if (InputsToHvacFlag)
+        {
+            InputsToHvacFlag = false;
+            inputsToHvac(InputRegister);
+        }
+        {
+            CostScope cost(COST_LOOP);
+            hvac->loop(Sim::nowMsec);
+        }
+        ThermostatCommon::loopCommit(Sim::nowMsec);
+        Furnace::loop(Sim::nowMsec);
+
+        int16_t target, actual;
+        if (comfort.heardSensor && hvac->GetTargetAndActual(target, actual))
+        {
+            double err = actual - target;
+            comfort.errorCx10Msec += err * dt;
+            comfort.absErrorCx10Msec += (err < 0 ? -err : err) * dt;
+            comfort.msec += dt;
+        }
+    }
+
+    void runUntil(unsigned long when)
+    {
+        while (Sim::nowMsec + loopMsec <= when)
+        {
+            Sim::nowMsec += loopMsec;
+            step(loopMsec);
+        }
+        Sim::nowMsec = when;
+    }
+
+    int replay(std::istream &trace)
+    {
+        std::string line;
+        unsigned lineNumber = 0;
+        while (std::getline(trace, line))
+        {
+            lineNumber += 1;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            std::istringstream iss(line);
+            unsigned long when;
+            std::string verb;
+            if (line.empty() || line[0] == '#')
+                continue;
+            if (!(iss >> when >> verb) || when < Sim::nowMsec)
+            {
+                std::cerr << "trace line " << lineNumber << " is bad or out of time order: " << line << std::endl;
+                return 1;
+            }
+            runUntil(when);
+            std::string rest;
+            std::getline(iss >> std::ws, rest);
+            if (verb == "CMD")
+                routeCommand(rest, -1, false);
+            else if (verb == "PKT")
+            {
+                std::istringstream pkt(rest);
+                unsigned sender;
+                pkt >> sender;
+                std::getline(pkt >> std::ws, rest);
+                routeCommand(rest, static_cast<uint8_t>(sender), true);
+            }
+            else if (verb == "IN")
+            {
+                uint8_t previous = InputRegister;
+                InputRegister = static_cast<uint8_t>(std::stoul(rest, 0, 16)) & INPUT_SIGNAL_MASK;
+                inputsToHvac(previous);
+            }
+            else
+            {
+                std::cerr << "trace line " << lineNumber << " has unknown event " << verb << std::endl;
+                return 1;
+            }
+        }
+        runUntil(Sim::nowMsec + 1000ul * tailSeconds);
+        return 0;
+    }
+
+    void report()
+    {
+        static const char * const SIGNAL_NAMES[NUMBER_OF_SIGNALS] = { "R/WF", "Z2", "Z1", "W", "ZX", "X2", "X1", "X3" };
+        for (int i = 0; i < NUMBER_OF_SIGNALS; i++)
+            if (OutputRegister & (1 << i))
+                outputStats.msecOn[i] += Sim::nowMsec - outputStats.onSince[i];
+
+        std::cout << "simulated " << std::fixed << std::setprecision(1) << Sim::nowMsec / 3600000.0 << " hours" << std::endl;
+        std::cout << "output  turned-on  hours-on" << std::endl;
+        for (int i = 0; i < NUMBER_OF_SIGNALS; i++)
+        {
+            if (((1 << i) & OUTPUT_SIGNAL_MASK) == 0)
+                continue;
+            std::cout << std::left << std::setw(8) << SIGNAL_NAMES[i] << std::right << std::setw(9) << outputStats.turnedOn[i] <<
+                std::setw(10) << std::setprecision(2) << outputStats.msecOn[i] / 3600000.0 << std::endl;
+        }
+        std::cout << "compressor starts " << outputStats.compressorStarts << ", short cycles (restart under " <<
+            shortCycleSeconds << "s) " << outputStats.compressorShortCycles << ", writes masked by hold " <<
+            outputStats.compressorBlocked << std::endl;
+        if (comfort.msec != 0)
+            std::cout << "comfort error (actual - target) mean " << std::setprecision(2) << comfort.errorCx10Msec / comfort.msec / 10 <<
+                "C, mean absolute " << comfort.absErrorCx10Msec / comfort.msec / 10 << "C" << std::endl;
+        std::cout << "EEPROM bytes written " << EEPROM.writes << std::endl;
+        std::cout << "call                    count   mean-nsec    max-nsec" << std::endl;
+        for (const auto &c : costs)
+            std::cout << std::left << std::setw(22) << c.name << std::right << std::setw(8) << c.count << std::setw(12) << std::setprecision(0) <<
+                (c.count ? c.totalNsec / c.count : 0) << std::setw(12) << c.maxNsec << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const char *USAGE =
+        "usage: PacketThermostatSim [-v] [-c <compressor mask hex>] [-h <hold seconds>] [-short <seconds>] [-step <msec>] [-tail <seconds>] [-e <eeprom image>] [-w <eeprom image>] <trace>";
+    const char *tracePath = 0;
+    const char *writePath = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-v")
+            Sim::verbose = true;
+        else if (arg == "-c" && hasValue)
+            compressorMask = static_cast<uint8_t>(strtoul(argv[++i], 0, 16));
+        else if (arg == "-h" && hasValue)
+            compressorHoldSeconds = atoi(argv[++i]);
+        else if (arg == "-short" && hasValue)
+            shortCycleSeconds = atoi(argv[++i]);
+        else if (arg == "-step" && hasValue)
+            loopMsec = std::max(1, atoi(argv[++i]));
+        else if (arg == "-tail" && hasValue)
+            tailSeconds = atoi(argv[++i]);
+        else if (arg == "-e" && hasValue)
+        {
+            std::ifstream image(argv[++i], std::ios::binary);
+            if (!image.read(reinterpret_cast<char *>(EEPROM.mem), sizeof(EEPROM.mem)))
+            {
+                std::cerr << "can't read " << sizeof(EEPROM.mem) << " bytes from " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "-w" && hasValue)
+            writePath = argv[++i];
+        else if (arg[0] != '-' && !tracePath)
+            tracePath = argv[i];
+        else
+        {
+            std::cerr << USAGE << std::endl;
+            return 1;
+        }
+    }
+    if (!tracePath)
+    {
+        std::cerr << USAGE << std::endl;
+        return 1;
+    }
+    std::ifstream trace(tracePath);
+    if (!trace)
+    {
+        std::cerr << "can't open " << tracePath << std::endl;
+        return 1;
+    }
+
+    ThermostatCommon::setup();
+    int ret = replay(trace);
+    report();
+    if (writePath)
+    {   // for a later run's -e
+        std::ofstream image(writePath, std::ios::binary);
+        if (!image.write(reinterpret_cast<const char *>(EEPROM.mem), sizeof(EEPROM.mem)))
+        {
+            std::cerr << "can't write " << writePath << std::endl;
+            return 1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,48 @@
+#pragma once
+/* Just enough of the Arduino API for HVAC.cpp and CommandTokens.cpp to compile natively.
+** millis() and micros() run on the simulation's virtual clock */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdio.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define E2END 0x3FF // ATmega32U4's 1K bytes of EEPROM
+
+#define HEX 16
+#define DEC 10
+
+class __FlashStringHelper;
+#define F(x) (x)
+
+namespace Sim {
+    extern unsigned long nowMsec; // the virtual clock
+    extern bool verbose; // echo the sketch's Serial output to stderr
+}
+
+inline unsigned long millis() { return Sim::nowMsec; }
+inline unsigned long micros() { return Sim::nowMsec * 1000ul; }
+
+class SimSerial {
+public:
+    size_t print(const char *s) { return out("%s", s); }
+    size_t print(char c) { return out("%c", c); }
+    size_t print(int v, int base = DEC) { return out(base == HEX ? "%x" : "%d", v); }
+    size_t print(unsigned v, int base = DEC) { return out(base == HEX ? "%x" : "%u", v); }
+    size_t print(long v, int base = DEC) { return out(base == HEX ? "%lx" : "%ld", v); }
+    size_t print(unsigned long v, int base = DEC) { return out(base == HEX ? "%lx" : "%lu", v); }
+    size_t print(double v, int digits = 2) { return out("%.*f", digits, v); }
+    template <typename T> size_t println(T v) { return print(v) + println(); }
+    template <typename T> size_t println(T v, int base) { return print(v, base) + println(); }
+    size_t println() { return out("\n"); }
+private:
+    template <typename... A> size_t out(const char *fmt, A... a)
+    {
+        return Sim::verbose ? fprintf(stderr, fmt, a...) : 0;
+    }
+};
+extern SimSerial Serial;
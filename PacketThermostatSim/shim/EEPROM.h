@@ -0,0 +1,23 @@
+#pragma once
+/* RAM backed EEPROM that counts the bytes actually written, as EEPROM wear */
+#include <Arduino.h>
+
+class EEPROMClass {
+public:
+    EEPROMClass() : writes(0) { memset(mem, 0xff, sizeof(mem)); }
+    uint8_t read(int a) const { return mem[a]; }
+    void write(int a, uint8_t v) { mem[a] = v; writes += 1; }
+    void update(int a, uint8_t v) { if (mem[a] != v) write(a, v); }
+    uint16_t length() const { return sizeof(mem); }
+    template <typename T> T &get(int a, T &t) const { memcpy(&t, &mem[a], sizeof(T)); return t; }
+    template <typename T> const T &put(int a, const T &t)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&t);
+        for (size_t i = 0; i < sizeof(T); i++)
+            update(a + i, p[i]);
+        return t;
+    }
+    uint8_t mem[E2END + 1];
+    unsigned long writes;
+};
+extern EEPROMClass EEPROM;
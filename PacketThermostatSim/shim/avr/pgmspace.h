@@ -0,0 +1,3 @@
+#pragma once
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))